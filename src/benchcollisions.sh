@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# GroundTraffic
+#
+# (c) Jonathan Harris 2013
+#
+# Licensed under GNU LGPL v2.1.
+#
+# Benchmark of finding potential collisions between routes (check_collisions() in groundtraffic.c) as the number of
+# routes grows from 100 to 10,000, on synthetic routes from gentraffic.
+#
+# Needs a plugin built with DO_BENCHMARK installed in a scenery package, and X-Plane running with the plane at
+# 47.015N 8.02E. For each case this writes the package's GroundTraffic.txt and deletes its collision cache, so that
+# collisions are found from scratch, then waits for you to reload scenery and reads the time from X-Plane's Log.txt.
+#
+# Usage: sh benchcollisions.sh "Custom Scenery/<package>" "<X-Plane>/Log.txt"
+#
+# Expected output, with one collision thread (the activating thread):
+#   routes  maxstep  check collisions [us]
+#      100        4     200-300
+#      100       30     400-500
+#     1000        4    1700-1900
+#     1000       30   14000-18000
+#     3000        4   12500-13500
+#     3000       30  156000-159000
+#    10000        4   89000-90000
+#    10000       30 1850000-1880000
+# maxstep 4 gives short roads that rarely cross, so time should grow roughly linearly with the number of routes.
+# maxstep 30 gives long roads that cross a lot (~4M collisions at 10000 routes), so time grows with the number of
+# collisions found.
+
+PACKAGE="$1"
+LOG="$2"
+GENTRAFFIC="${GENTRAFFIC:-$(dirname "$0")/$(uname)64/gentraffic}"
+CASES="100:4 100:30 1000:4 1000:30 3000:4 3000:30 10000:4 10000:30"
+TIMING="us in activate check collisions"
+
+if [ ! -d "$PACKAGE" ] || [ ! -f "$LOG" ]; then
+    echo "Usage: $0 \"Custom Scenery/<package>\" \"<X-Plane>/Log.txt\"" >&2
+    exit 1
+fi
+if [ ! -x "$GENTRAFFIC" ]; then
+    make -C "$(dirname "$0")" -f Makefile.lin gentraffic || exit 1
+fi
+
+# Overwrite the existing config, whatever its case
+CONFIG="$(ls "$PACKAGE" | grep -i '^groundtraffic\.txt$' | head -1)"
+CONFIG="$PACKAGE/${CONFIG:-GroundTraffic.txt}"
+
+printf "%8s %8s  %s\n" routes maxstep "check collisions [us]"
+for c in $CASES; do
+    routes=${c%:*}
+    maxstep=${c#*:}
+    "$GENTRAFFIC" "$routes" "$maxstep" > "$CONFIG" || exit 1
+    rm -f "$PACKAGE/groundtraffic.cache"
+    seen=$(grep -c "$TIMING" "$LOG")
+    echo "Reload scenery in X-Plane now" >&2
+    while [ "$(grep -c "$TIMING" "$LOG")" -le "$seen" ]; do
+        sleep 1
+    done
+    printf "%8s %8s  %s\n" "$routes" "$maxstep" "$(grep "$TIMING" "$LOG" | tail -1 | sed 's/.*: \([0-9]*\) us.*/\1/')"
+done
@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# GroundTraffic
+#
+# (c) Jonathan Harris 2013
+#
+# Licensed under GNU LGPL v2.1.
+#
+# Benchmark of the per-frame cost of updating and drawing routes (drawcallback() in draw.c) with 1k, 10k and 50k
+# vehicles, on synthetic routes from gentraffic.
+#
+# Needs a plugin built with DO_BENCHMARK installed in a scenery package, and X-Plane running with the plane at
+# 47.015N 8.02E. For each case this writes the package's GroundTraffic.txt, waits for you to reload scenery and lets
+# the routes run for SETTLE seconds. The plugin logs the average time per frame in drawcallback() to X-Plane's Log.txt
+# when it deactivates on the next reload - averaged over the frames since the first route last reached a waypoint,
+# i.e. over the last few seconds.
+#
+# Usage: sh benchdraw.sh "Custom Scenery/<package>" "<X-Plane>/Log.txt"
+#
+# Expected output, with the pose phase in one thread (the main thread):
+#   routes  drawcallback [us/frame]
+#     1000        60-90
+#    10000     1400-1600
+#    50000    12000-14000
+
+PACKAGE="$1"
+LOG="$2"
+GENTRAFFIC="${GENTRAFFIC:-$(dirname "$0")/$(uname)64/gentraffic}"
+SETTLE="${SETTLE:-60}"
+CASES="1000 10000 50000"
+ACTIVATED="us in activate check collisions"
+TIMING="us per frame in drawcallback"
+
+if [ ! -d "$PACKAGE" ] || [ ! -f "$LOG" ]; then
+    echo "Usage: $0 \"Custom Scenery/<package>\" \"<X-Plane>/Log.txt\"" >&2
+    exit 1
+fi
+if [ ! -x "$GENTRAFFIC" ]; then
+    make -C "$(dirname "$0")" -f Makefile.lin gentraffic || exit 1
+fi
+
+# Overwrite the existing config, whatever its case
+CONFIG="$(ls "$PACKAGE" | grep -i '^groundtraffic\.txt$' | head -1)"
+CONFIG="$PACKAGE/${CONFIG:-GroundTraffic.txt}"
+
+# Wait until the plugin has logged more than $2 lines containing $1
+waitfor()
+{
+    while [ "$(grep -c "$1" "$LOG")" -le "$2" ]; do
+        sleep 1
+    done
+}
+
+# Each reload logs the time for the outgoing case, then activates the next
+printf "%8s  %s\n" routes "drawcallback [us/frame]"
+rest="$CASES"
+next="${rest%% *}"
+while [ -n "$next" ]; do
+    routes="$next"
+    rest="${rest#"$routes"}"
+    rest="${rest# }"
+    next="${rest%% *}"
+    if [ "$routes" = "${CASES%% *}" ]; then
+        activated=$(grep -c "$ACTIVATED" "$LOG")
+        "$GENTRAFFIC" "$routes" 4 > "$CONFIG" || exit 1
+        echo "Reload scenery in X-Plane now" >&2
+        waitfor "$ACTIVATED" "$activated"
+    fi
+    sleep "$SETTLE"
+
+    activated=$(grep -c "$ACTIVATED" "$LOG")
+    timed=$(grep -c "$TIMING" "$LOG")
+    if [ -n "$next" ]; then
+        "$GENTRAFFIC" "$next" 4 > "$CONFIG" || exit 1
+    fi
+    echo "Reload scenery in X-Plane now" >&2
+    waitfor "$TIMING" "$timed"
+    printf "%8s  %s\n" "$routes" "$(grep "$TIMING" "$LOG" | tail -1 | sed 's/.*: \([0-9]*\) us.*/\1/')"
+    if [ -n "$next" ]; then
+        waitfor "$ACTIVATED" "$activated"
+    fi
+done
@@ -0,0 +1,117 @@
+/*
+ * GroundTraffic
+ *
+ * (c) Jonathan Harris 2013
+ *
+ * Licensed under GNU LGPL v2.1.
+ */
+
+#ifndef	_BEZIER_H_
+#define	_BEZIER_H_
+
+/* Unlike intersect4() results don't need to be identical to a scalar calculation, so use SSE wherever it's available.
+ * Define BEZIER_SSE=0 to force the scalar version, e.g. to test it. */
+#ifndef BEZIER_SSE
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define BEZIER_SSE 1
+#  else
+#    define BEZIER_SSE 0
+#  endif
+#endif
+#if BEZIER_SSE
+#  include <emmintrin.h>
+#endif
+
+/* Headings from bez4() are within this many degrees of R2D(atan2f()) of the same tangent - checked by beztest.c.
+ * The error is dominated by atan2_poly() which is good to 1.15e-5 radians = 0.00066 degrees. */
+#define BEZIER_TOLERANCE 0.001f
+
+/* Minimax polynomial for atan(t) 0<=t<=1 - Hastings, "Approximations for Digital Computers", 1955 */
+#define ATAN_C1	 0.9998660f
+#define ATAN_C3	-0.3302995f
+#define ATAN_C5	 0.1801410f
+#define ATAN_C7	-0.0851330f
+#define ATAN_C9	 0.0208351f
+#define ATAN_MIN 1e-30f		/* Avoid 0/0 for a zero-length tangent */
+
+/* Four quadratic Bezier curves p1->p2->p3 to be evaluated at mu, and the results */
+typedef struct
+{
+    float p1x[4], p1z[4], p2x[4], p2z[4], p3x[4], p3z[4], mu[4];
+    float x[4], z[4], heading[4];	/* heading in degrees, as returned by bez() */
+    float dx[4], dz[4];			/* Unit tangent, i.e. sin and -cos of heading */
+} bez4_t;
+
+
+/* Approximation to atan2f(y, x) using the same polynomial as the SSE version, for consistency across platforms */
+static inline float atan2_poly(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float mx = ax > ay ? ax : ay, mn = ax > ay ? ay : ax;
+    float t = mn / (mx > ATAN_MIN ? mx : ATAN_MIN), s = t * t;
+    float r = t * (ATAN_C1 + s * (ATAN_C3 + s * (ATAN_C5 + s * (ATAN_C7 + s * ATAN_C9))));
+
+    if (ay > ax) r = (float) M_PI_2 - r;
+    if (x < 0)   r = (float) M_PI - r;
+    return y < 0 ? -r : r;
+}
+
+#if BEZIER_SSE
+static inline __m128 atan2_poly4(__m128 y, __m128 x)
+{
+    __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));	/* Not -0.f, which -ffast-math may treat as 0 */
+    __m128 ax = _mm_andnot_ps(sign, x), ay = _mm_andnot_ps(sign, y);
+    __m128 mx = _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(ATAN_MIN)), mn = _mm_min_ps(ax, ay);
+    __m128 t = _mm_div_ps(mn, mx), s = _mm_mul_ps(t, t);
+    __m128 r = _mm_add_ps(_mm_set1_ps(ATAN_C7), _mm_mul_ps(s, _mm_set1_ps(ATAN_C9)));
+    __m128 swap = _mm_cmpgt_ps(ay, ax), neg = _mm_cmplt_ps(x, _mm_setzero_ps());
+
+    r = _mm_add_ps(_mm_set1_ps(ATAN_C5), _mm_mul_ps(s, r));
+    r = _mm_add_ps(_mm_set1_ps(ATAN_C3), _mm_mul_ps(s, r));
+    r = _mm_mul_ps(t, _mm_add_ps(_mm_set1_ps(ATAN_C1), _mm_mul_ps(s, r)));
+    r = _mm_or_ps(_mm_and_ps(swap, _mm_sub_ps(_mm_set1_ps((float) M_PI_2), r)), _mm_andnot_ps(swap, r));
+    r = _mm_or_ps(_mm_and_ps(neg, _mm_sub_ps(_mm_set1_ps((float) M_PI), r)), _mm_andnot_ps(neg, r));
+    return _mm_xor_ps(r, _mm_and_ps(y, sign));		/* Take sign of y */
+}
+#endif
+
+/* Position and heading along each of four quadratic Bezier curves */
+static inline void bez4(bez4_t *b)
+{
+#if BEZIER_SSE
+    __m128 mu = _mm_loadu_ps(b->mu), two = _mm_set1_ps(2);
+    __m128 mum1 = _mm_sub_ps(_mm_set1_ps(1), mu);
+    __m128 mum12 = _mm_mul_ps(mum1, mum1), mu2 = _mm_mul_ps(mu, mu), mid = _mm_mul_ps(two, _mm_mul_ps(mum1, mu));
+    __m128 p1x = _mm_loadu_ps(b->p1x), p2x = _mm_loadu_ps(b->p2x), p3x = _mm_loadu_ps(b->p3x);
+    __m128 p1z = _mm_loadu_ps(b->p1z), p2z = _mm_loadu_ps(b->p2z), p3z = _mm_loadu_ps(b->p3z);
+    __m128 tx, tz, len;
+
+    _mm_storeu_ps(b->x, _mm_add_ps(_mm_add_ps(_mm_mul_ps(p1x, mum12), _mm_mul_ps(p2x, mid)), _mm_mul_ps(p3x, mu2)));
+    _mm_storeu_ps(b->z, _mm_add_ps(_mm_add_ps(_mm_mul_ps(p1z, mum12), _mm_mul_ps(p2z, mid)), _mm_mul_ps(p3z, mu2)));
+    tx = _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(mum1, _mm_sub_ps(p2x, p1x)), _mm_mul_ps(mu, _mm_sub_ps(p3x, p2x))));
+    tz = _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(mum1, _mm_sub_ps(p1z, p2z)), _mm_mul_ps(mu, _mm_sub_ps(p2z, p3z))));
+    _mm_storeu_ps(b->heading, _mm_mul_ps(atan2_poly4(tx, tz), _mm_set1_ps((float) (180*M_1_PI))));
+    len = _mm_sqrt_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(tz, tz)), _mm_set1_ps(ATAN_MIN)));
+    _mm_storeu_ps(b->dx, _mm_div_ps(tx, len));
+    _mm_storeu_ps(b->dz, _mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), tz), len));
+#else
+    int i;
+
+    for (i=0; i<4; i++)
+    {
+        float mu = b->mu[i], mum1 = 1 - mu;
+        float mum12 = mum1 * mum1, mu2 = mu * mu, mid = 2 * mum1 * mu;
+        float tx = 2 * (mum1 * (b->p2x[i] - b->p1x[i]) + mu * (b->p3x[i] - b->p2x[i]));
+        float tz = 2 * (mum1 * (b->p1z[i] - b->p2z[i]) + mu * (b->p2z[i] - b->p3z[i]));
+        float len = sqrtf(tx * tx + tz * tz > ATAN_MIN ? tx * tx + tz * tz : ATAN_MIN);
+
+        b->x[i] = b->p1x[i] * mum12 + b->p2x[i] * mid + b->p3x[i] * mu2;
+        b->z[i] = b->p1z[i] * mum12 + b->p2z[i] * mid + b->p3z[i] * mu2;
+        b->heading[i] = atan2_poly(tx, tz) * ((float) (180*M_1_PI));
+        b->dx[i] = tx / len;
+        b->dz[i] = -tz / len;
+    }
+#endif
+}
+
+#endif /* _BEZIER_H_ */
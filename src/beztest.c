@@ -0,0 +1,282 @@
+/*
+ * GroundTraffic
+ *
+ * (c) Jonathan Harris 2013
+ *
+ * Licensed under GNU LGPL v2.1.
+ */
+
+/* Standalone check of bez4() against the scalar bez() + atan2f() that it replaced, plus a microbenchmark of the two.
+ * Build and run with "make -f Makefile.lin beztest", which tests both the SSE and the scalar (BEZIER_SSE=0) versions. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bezier.h"
+
+#define R2D(r) ((r) * ((float) (180*M_1_PI)))
+#define D2R(d) ((d) * ((float) (M_PI/180)))
+
+#define NRANDOM 1000000		/* Number of random curves to check */
+#define POS_TOLERANCE 0.01f	/* [m] Coordinates are up to ~10km from the origin, where a float is good to ~1mm */
+#define DIR_TOLERANCE 0.0001f	/* Unit tangent vs sin & -cos of the heading. BEZIER_TOLERANCE degrees is 1.7e-5 */
+#define BENCH_CURVES 4096	/* Small enough to stay in cache, so we time the arithmetic */
+#define BENCH_PASSES 2000
+
+typedef struct
+{
+    float x, z;
+} point_t;
+
+typedef struct
+{
+    float x, z, heading;
+} pose_t;
+
+static int failures = 0;
+static float max_heading_err = 0, max_pos_err = 0, max_dir_err = 0;
+
+
+/* The scalar calculation that bez4() replaced */
+static void bez(pose_t *pose, const point_t *p1, const point_t *p2, const point_t *p3, float mu)
+{
+    float mum1, mum12, mu2;
+    float tx, tz;
+
+    mu2 = mu * mu;
+    mum1 = 1 - mu;
+    mum12 = mum1 * mum1;
+    pose->x = p1->x * mum12 + 2 * p2->x * mum1 * mu + p3->x * mu2;
+    pose->z = p1->z * mum12 + 2 * p2->z * mum1 * mu + p3->z * mu2;
+
+    tx = 2 * mum1 * (p2->x - p1->x) + 2 * mu * (p3->x - p2->x);
+    tz =-2 * mum1 * (p2->z - p1->z) - 2 * mu * (p3->z - p2->z);
+    pose->heading = R2D(atan2f(tx, tz));
+}
+
+
+/* Length of the tangent, relative to the size of the curve, below which the heading is at the mercy of rounding */
+static float tangent_ratio(const point_t *p1, const point_t *p2, const point_t *p3, float mu)
+{
+    double m = mu, x1 = p1->x, z1 = p1->z, x2 = p2->x, z2 = p2->z, x3 = p3->x, z3 = p3->z;
+    double tx = 2 * (1-m) * (x2 - x1) + 2 * m * (x3 - x2);
+    double tz = 2 * (1-m) * (z2 - z1) + 2 * m * (z3 - z2);
+    double size = fabs(x2 - x1) + fabs(z2 - z1) + fabs(x3 - x2) + fabs(z3 - z2);
+    return size ? (float) (sqrt(tx*tx + tz*tz) / size) : 0;
+}
+
+
+/* Is f a number? Checks the bits since -ffast-math lets the compiler assume that it is */
+static int finite_bits(float f)
+{
+    unsigned int u;
+    memcpy(&u, &f, sizeof(u));
+    return (u & 0x7f800000) != 0x7f800000;
+}
+
+
+static void fail(const char *what, int i, const bez4_t *b, const pose_t *ref)
+{
+    if (++failures <= 10)
+        printf("FAIL %s: p1=(%g,%g) p2=(%g,%g) p3=(%g,%g) mu=%g: bez4 x=%g z=%g heading=%g dx=%g dz=%g, bez x=%g z=%g heading=%g\n",
+               what, (double) b->p1x[i], (double) b->p1z[i], (double) b->p2x[i], (double) b->p2z[i], (double) b->p3x[i], (double) b->p3z[i],
+               (double) b->mu[i], (double) b->x[i], (double) b->z[i], (double) b->heading[i], (double) b->dx[i], (double) b->dz[i],
+               (double) ref->x, (double) ref->z, (double) ref->heading);
+}
+
+
+/* Compare lane i of an evaluated bez4_t with bez(). Heading is only compared if the tangent isn't (close to) zero. */
+static void check(const bez4_t *b, int i, int degenerate)
+{
+    point_t p1 = { b->p1x[i], b->p1z[i] }, p2 = { b->p2x[i], b->p2z[i] }, p3 = { b->p3x[i], b->p3z[i] };
+    pose_t ref;
+    float err;
+
+    bez(&ref, &p1, &p2, &p3, b->mu[i]);
+
+    if (!finite_bits(b->x[i]) || !finite_bits(b->z[i]) || !finite_bits(b->heading[i]) ||
+        !finite_bits(b->dx[i]) || !finite_bits(b->dz[i]))
+    {
+        fail("not finite", i, b, &ref);
+        return;
+    }
+
+    err = fmaxf(fabsf(b->x[i] - ref.x), fabsf(b->z[i] - ref.z));
+    if (err > max_pos_err) max_pos_err = err;
+    if (err > POS_TOLERANCE)
+        fail("position", i, b, &ref);
+
+    if (degenerate)
+    {
+        /* Heading is arbitrary, but must still be a heading, and the "unit" tangent mustn't blow up */
+        if (fabsf(b->heading[i]) > 180 + BEZIER_TOLERANCE || fabsf(b->dx[i]) > 1 + DIR_TOLERANCE || fabsf(b->dz[i]) > 1 + DIR_TOLERANCE)
+            fail("zero-length tangent", i, b, &ref);
+        return;
+    }
+    else if (tangent_ratio(&p1, &p2, &p3, b->mu[i]) < 1e-3f)
+        return;
+
+    err = fabsf(b->heading[i] - ref.heading);
+    if (err > 180) err = 360 - err;	/* +180 and -180 are the same heading */
+    if (err > max_heading_err) max_heading_err = err;
+    if (err > BEZIER_TOLERANCE)
+        fail("heading", i, b, &ref);
+
+    err = fmaxf(fabsf(b->dx[i] - sinf(D2R(ref.heading))), fabsf(b->dz[i] + cosf(D2R(ref.heading))));
+    if (err > max_dir_err) max_dir_err = err;
+    if (err > DIR_TOLERANCE)
+        fail("unit tangent", i, b, &ref);
+}
+
+
+static float frand(float lo, float hi)
+{
+    return lo + (hi - lo) * (float) rand() / (float) RAND_MAX;
+}
+
+
+static void set(bez4_t *b, int i, float p1x, float p1z, float p2x, float p2z, float p3x, float p3z, float mu)
+{
+    b->p1x[i] = p1x;  b->p1z[i] = p1z;
+    b->p2x[i] = p2x;  b->p2z[i] = p2z;
+    b->p3x[i] = p3x;  b->p3z[i] = p3z;
+    b->mu[i] = mu;
+}
+
+
+/* Curves whose tangent is zero at the chosen mu, mixed in with a normal curve in each batch */
+static void test_degenerate(void)
+{
+    static const float mus[] = { -0.25f, 0, 0.25f, 0.5f, 0.75f, 1, 1.25f };
+    bez4_t b;
+    int i, j;
+
+    for (i = 0; i < sizeof(mus)/sizeof(mus[0]); i++)
+    {
+        set(&b, 0, 100, -200, 100, -200, 100, -200, mus[i]);	/* A point */
+        set(&b, 1, 0, 0, 0, 0, 0, 0, mus[i]);				/* A point at the origin, so that tx and tz are +/-0 */
+        set(&b, 2, -50, 30, 50, -30, -50, 30, 0.5f);			/* Doubles back on itself - stationary at mu=0.5 */
+        set(&b, 3, 10, 20, 30, 40, 50, 60, mus[i]);			/* Straight line */
+        bez4(&b);
+        for (j = 0; j < 3; j++)
+            check(&b, j, 1);
+        check(&b, 3, 0);
+
+        set(&b, 0, 10, 10, 10, 10, 40, -30, 0);		/* p1==p2, so tangent is zero at mu=0 */
+        set(&b, 1, 10, 10, 40, -30, 40, -30, 1);	/* p2==p3, so tangent is zero at mu=1 */
+        set(&b, 2, 10, 10, 10, 10, 40, -30, mus[i]);	/* and elsewhere along those curves */
+        set(&b, 3, 10, 10, 40, -30, 40, -30, mus[i]);
+        bez4(&b);
+        check(&b, 0, 1);
+        check(&b, 1, 1);
+        check(&b, 2, mus[i] == 0);
+        check(&b, 3, mus[i] == 1);
+    }
+}
+
+
+/* Turns of various sizes anywhere within an airport, evaluated a little beyond either end as trains can be */
+static void test_random(void)
+{
+    bez4_t b;
+    int n, i;
+
+    srand(1);
+    for (n = 0; n < NRANDOM / 4; n++)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            float x = frand(-5000, 5000), z = frand(-5000, 5000), size = frand(0.1f, 200);
+            set(&b, i, x, z, x + frand(-size, size), z + frand(-size, size), x + frand(-size, size), z + frand(-size, size), frand(-0.25f, 1.25f));
+        }
+        bez4(&b);
+        for (i = 0; i < 4; i++)
+            check(&b, i, 0);
+    }
+
+    /* Every octant and the axes, to catch sign and quadrant mistakes */
+    for (n = 0; n < 360; n += 4)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            float s = sinf(D2R((float) (n + i))), c = cosf(D2R((float) (n + i)));
+            set(&b, i, 0, 0, 50 * s, -50 * c, 100 * s, -100 * c, 0.5f);	/* heading n+i */
+        }
+        bez4(&b);
+        for (i = 0; i < 4; i++)
+            check(&b, i, 0);
+    }
+}
+
+
+static double elapsed_us(const struct timeval *t1)
+{
+    struct timeval t2;
+    gettimeofday(&t2, NULL);
+    return (t2.tv_sec - t1->tv_sec) * 1e6 + (t2.tv_usec - t1->tv_usec);
+}
+
+
+static void benchmark(void)
+{
+    static bez4_t b[BENCH_CURVES/4];
+    static point_t p1[BENCH_CURVES], p2[BENCH_CURVES], p3[BENCH_CURVES];
+    static float mu[BENCH_CURVES];
+    static pose_t poses[BENCH_CURVES];
+    volatile float sink = 0;
+    struct timeval t1;
+    double scalar, batch;
+    int pass, i;
+
+    srand(2);
+    for (i = 0; i < BENCH_CURVES; i++)
+    {
+        p1[i].x = frand(-5000, 5000);  p1[i].z = frand(-5000, 5000);
+        p2[i].x = p1[i].x + frand(-50, 50);  p2[i].z = p1[i].z + frand(-50, 50);
+        p3[i].x = p2[i].x + frand(-50, 50);  p3[i].z = p2[i].z + frand(-50, 50);
+        mu[i] = frand(0, 1);
+        set(b + i/4, i%4, p1[i].x, p1[i].z, p2[i].x, p2[i].z, p3[i].x, p3[i].z, mu[i]);
+    }
+
+    gettimeofday(&t1, NULL);
+    for (pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        for (i = 0; i < BENCH_CURVES; i++)
+            bez(poses + i, p1 + i, p2 + i, p3 + i, mu[i]);
+        sink += poses[pass % BENCH_CURVES].heading;
+    }
+    scalar = elapsed_us(&t1);
+
+    gettimeofday(&t1, NULL);
+    for (pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        for (i = 0; i < BENCH_CURVES/4; i++)
+            bez4(b + i);
+        sink += b[pass % (BENCH_CURVES/4)].heading[0];
+    }
+    batch = elapsed_us(&t1);
+
+    printf("bez: %.2f ns/curve, bez4: %.2f ns/curve, %.2fx\n",
+           scalar * 1000 / ((double) BENCH_PASSES * BENCH_CURVES), batch * 1000 / ((double) BENCH_PASSES * BENCH_CURVES), scalar / batch);
+    (void) sink;
+}
+
+
+int main(void)
+{
+    printf("bez4 %s version\n", BEZIER_SSE ? "SSE" : "scalar");
+    test_degenerate();
+    test_random();
+    printf("max error: heading %g degrees (tolerance %g), position %g m, unit tangent %g\n",
+           (double) max_heading_err, (double) BEZIER_TOLERANCE, (double) max_pos_err, (double) max_dir_err);
+    if (failures)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    benchmark();
+    return 0;
+}
@@ -0,0 +1,320 @@
+/*
+ * GroundTraffic
+ *
+ * (c) Jonathan Harris 2013
+ *
+ * Licensed under GNU LGPL v2.1.
+ */
+
+#include "groundtraffic.h"
+#include "planes.h"
+
+/* Collision cache file format, in native byte order:
+ *   char magic[4]
+ *   int version
+ *   int route count, followed by an unsigned long long hash of each route's geometry
+ *   int hit count, followed by a hit_t per collision - route indices refer to the list of hashes
+ * Routes that share the same geometry are left out since we can't tell them apart.
+ *
+ * ACF cache file format, in native byte order:
+ *   char magic[4]
+ *   int version
+ *   int count, followed by an acf_entry_t per ACF file */
+
+/* A cached route's hash and its index in the cache, for looking up routes by hash. Sorts with sorthash() */
+typedef struct
+{
+    unsigned long long hash;
+    int index;
+} cachehash_t;
+
+/* In this file */
+static unsigned long long routehash(const route_t *route);
+static int sorthash(const void *a, const void *b);
+static char *cachepath(char *buffer, const char *name);
+
+
+/* Determine which routes' collisions can be restored from the collision cache, and restore them into restored->hits.
+ * Sets grid->cached[i] to route i's index in the cache, -1 if it isn't in the cache, or -2 if it can't be cached.
+ * Sets grid->cache_dirty if any collisions need calculating, or if the cache is otherwise out of date.
+ * Returns 0 if out of memory. */
+int read_collision_cache(collision_grid_t *grid, int nroutes, collision_task_t *restored)
+{
+    char buffer[PATH_MAX];
+    unsigned long long *sorted, *hashes = NULL;
+    cachehash_t *lookup = NULL;	/* Cached routes sorted by hash */
+    int *cacheroutes = NULL;	/* Index of each cached route in grid->routes, or -1 */
+    int ncache, nhits, i, n, last, result = -1;
+    long size;
+    FILE *h;
+
+    grid->cache_dirty = -1;
+    if (!(grid->hashes = malloc(nroutes * sizeof(unsigned long long))) ||
+        !(grid->cached = malloc(nroutes * sizeof(int))) ||
+        !(sorted = malloc(nroutes * sizeof(unsigned long long))))
+        return xplog("Out of memory!");
+
+    for (i=0; i<nroutes; i++)
+    {
+        sorted[i] = grid->hashes[i] = routehash(grid->routes[i]);
+        grid->cached[i] = -1;
+    }
+    qsort(sorted, nroutes, sizeof(unsigned long long), sorthash);
+    for (i=0; i<nroutes; i++)
+    {
+        unsigned long long *found = bsearch(grid->hashes + i, sorted, nroutes, sizeof(unsigned long long), sorthash);
+        if ((found > sorted && found[-1] == found[0]) || (found < sorted + nroutes-1 && found[1] == found[0]))
+            grid->cached[i] = -2;	/* Duplicate geometry */
+    }
+    free(sorted);
+
+    if (!(h = fopen(cachepath(buffer, COLLISION_CACHE), "rb")))
+        return -1;	/* No cache */
+
+    /* Validate */
+    fseek(h, 0, SEEK_END);
+    size = ftell(h);
+    fseek(h, 0, SEEK_SET);
+    if (fread(buffer, 4, 1, h) != 1 || memcmp(buffer, COLLISION_CACHE_MAGIC, 4) ||
+        fread(&i, sizeof(int), 1, h) != 1 || i != COLLISION_CACHE_VERSION ||
+        fread(&ncache, sizeof(int), 1, h) != 1 || ncache < 0 ||
+        ncache > size / (long) sizeof(unsigned long long))
+    {
+        fclose(h);
+        return -1;	/* Different version, or corrupt */
+    }
+    if (!(hashes = malloc((ncache+1) * sizeof(unsigned long long))) || !(cacheroutes = malloc((ncache+1) * sizeof(int))) ||
+        !(lookup = malloc((ncache+1) * sizeof(cachehash_t))))
+    {
+        result = xplog("Out of memory!");
+    }
+    else if (fread(hashes, sizeof(unsigned long long), ncache, h) != ncache ||
+             fread(&nhits, sizeof(int), 1, h) != 1 || nhits < 0 ||
+             size != 4 + 3 * (long) sizeof(int) + ncache * (long) sizeof(unsigned long long) + nhits * (long) sizeof(hit_t))
+    {
+        /* Corrupt */
+    }
+    else if (nhits && !(restored->hits = malloc(nhits * sizeof(hit_t))))
+    {
+        result = xplog("Out of memory!");
+    }
+    else
+    {
+        /* Match cached routes to our routes. The cache is up to date if every route matches, in the same order */
+        for (i=0; i<ncache; i++)
+        {
+            cacheroutes[i] = -1;
+            lookup[i].hash = hashes[i];
+            lookup[i].index = i;
+        }
+        qsort(lookup, ncache, sizeof(cachehash_t), sorthash);
+        for (i=0; i<nroutes; i++)
+            if (grid->cached[i] == -1)
+            {
+                cachehash_t *found = bsearch(grid->hashes + i, lookup, ncache, sizeof(cachehash_t), sorthash);
+                if (found)
+                {
+                    grid->cached[i] = found->index;
+                    cacheroutes[found->index] = i;
+                }
+            }
+        grid->cache_dirty = 0;
+        for (i=0, last=-1; i<ncache; i++)
+            if (cacheroutes[i] < 0 || cacheroutes[i] < last)
+                grid->cache_dirty = -1;		/* Route has been deleted or changed, or routes are in a different order */
+            else
+                last = cacheroutes[i];
+        for (i=0; i<nroutes; i++)
+            if (grid->cached[i] < 0)
+                grid->cache_dirty = -1;		/* Route is new or changed */
+
+        /* Restore collisions between cached routes that are still in the same order */
+        for (i=0; i<nhits; i++)
+        {
+            hit_t *hit = restored->hits + restored->nhits;
+            if (fread(hit, sizeof(hit_t), 1, h) != 1 ||
+                hit->route < 0 || hit->route >= ncache || hit->other < 0 || hit->other >= ncache ||
+                ((hit->route = cacheroutes[hit->route]) >= 0 && (hit->other = cacheroutes[hit->other]) > hit->route &&
+                 (hit->node < 0 || hit->node >= grid->routes[hit->route]->pathlen ||
+                  hit->othernode < 0 || hit->othernode >= grid->routes[hit->other]->pathlen)))
+            {
+                /* Corrupt - calculate everything */
+                for (n=0; n<nroutes; n++)
+                    if (grid->cached[n] >= 0) grid->cached[n] = -1;
+                restored->nhits = 0;
+                grid->cache_dirty = -1;
+                break;
+            }
+            else if (hit->route >= 0 && hit->other > hit->route)
+                restored->nhits++;
+        }
+        restored->maxhits = nhits;
+    }
+
+    fclose(h);
+    free(hashes);
+    free(cacheroutes);
+    free(lookup);
+    return result;
+}
+
+
+/* Save all collisions between routes to the collision cache */
+void write_collision_cache(const collision_grid_t *grid, int nroutes, const collision_task_t *tasks, int ntasks)
+{
+    char buffer[PATH_MAX];
+    int *cacheroutes;	/* Index of each route in the cache */
+    int ncache, nhits, i, j, version = COLLISION_CACHE_VERSION;
+    FILE *h;
+
+    if (!(cacheroutes = malloc(nroutes * sizeof(int))))
+    {
+        xplog("Out of memory!");
+        return;
+    }
+    for (i=0, ncache=0; i<nroutes; i++)
+        cacheroutes[i] = grid->cached[i] == -2 ? -1 : ncache++;
+    for (i=0, nhits=0; i<ntasks; i++)
+        for (j=0; j<tasks[i].nhits; j++)
+            if (cacheroutes[tasks[i].hits[j].route] >= 0 && cacheroutes[tasks[i].hits[j].other] >= 0)
+                nhits++;
+
+    if (!(h = fopen(cachepath(buffer, COLLISION_CACHE), "wb")))
+    {
+        free(cacheroutes);
+        return;		/* Silently fail - e.g. read-only scenery package */
+    }
+    fwrite(COLLISION_CACHE_MAGIC, 4, 1, h);
+    fwrite(&version, sizeof(int), 1, h);
+    fwrite(&ncache, sizeof(int), 1, h);
+    for (i=0; i<nroutes; i++)
+        if (cacheroutes[i] >= 0)
+            fwrite(grid->hashes + i, sizeof(unsigned long long), 1, h);
+    fwrite(&nhits, sizeof(int), 1, h);
+    for (i=0; i<ntasks; i++)
+        for (j=0; j<tasks[i].nhits; j++)
+            if (cacheroutes[tasks[i].hits[j].route] >= 0 && cacheroutes[tasks[i].hits[j].other] >= 0)
+            {
+                hit_t hit = tasks[i].hits[j];
+                hit.route = cacheroutes[hit.route];
+                hit.other = cacheroutes[hit.other];
+                fwrite(&hit, sizeof(hit_t), 1, h);
+            }
+    if (ferror(h) | fclose(h))
+    {
+        remove(buffer);		/* Don't leave a partial file behind */
+        xplog("Can't write collision cache");
+    }
+    free(cacheroutes);
+}
+
+
+/* Hash of everything about a route that affects its collisions - i.e. its path's waypoints and whether it circles back */
+static unsigned long long routehash(const route_t *route)
+{
+    /* FNV-1a http://www.isthe.com/chongo/tech/comp/fnv/ */
+    unsigned long long hash = 14695981039346656037ULL;
+    int rev = route->path[route->pathlen-1].flags.reverse ? 1 : 0;
+    int i;
+
+#define HASH(v) { const unsigned char *c = (const unsigned char *) &(v); int j; for (j=0; j<sizeof(v); j++) hash = (hash ^ c[j]) * 1099511628211ULL; }
+    HASH(route->pathlen);
+    HASH(rev);
+    for (i=0; i<route->pathlen; i++)
+    {
+        HASH(route->path[i].waypoint.lat);
+        HASH(route->path[i].waypoint.lon);
+    }
+#undef HASH
+
+    return hash;
+}
+
+
+/* Compare hashes, or cachehash_t's by their hash */
+static int sorthash(const void *a, const void *b)
+{
+    const unsigned long long *ha = a, *hb = b;
+    return (*ha > *hb) - (*ha < *hb);
+}
+
+
+/* Read the dimensions of ACF files that we've previously read. Returns the number of entries */
+int read_acf_cache(acf_entry_t **entries)
+{
+    char buffer[PATH_MAX];
+    int i, count = 0;
+    long size;
+    FILE *h;
+
+    *entries = NULL;
+    if (!(h = fopen(cachepath(buffer, ACF_CACHE), "rb")))
+        return 0;	/* No cache */
+
+    fseek(h, 0, SEEK_END);
+    size = ftell(h);
+    fseek(h, 0, SEEK_SET);
+    if (fread(buffer, 4, 1, h) != 1 || memcmp(buffer, ACF_CACHE_MAGIC, 4) ||
+        fread(&i, sizeof(int), 1, h) != 1 || i != ACF_CACHE_VERSION ||
+        fread(&count, sizeof(int), 1, h) != 1 || count <= 0 ||
+        size != 4 + 2 * (long) sizeof(int) + count * (long) sizeof(acf_entry_t))
+    {
+        count = 0;	/* Different version, or corrupt */
+    }
+    else if (!(*entries = malloc(count * sizeof(acf_entry_t))))
+    {
+        count = xplog("Out of memory!");
+    }
+    else if (fread(*entries, sizeof(acf_entry_t), count, h) != count)
+    {
+        free(*entries);
+        *entries = NULL;
+        count = 0;
+    }
+    else
+    {
+        for (i=0; i<count; i++)
+        {
+            (*entries)[i].path[MAX_ACF_PATH-1] = '\0';
+            (*entries)[i].parsed = -1;
+        }
+    }
+
+    fclose(h);
+    return count;
+}
+
+
+/* Save the dimensions of the ACF files that we've read */
+void write_acf_cache(const acf_entry_t *entries, int count)
+{
+    char buffer[PATH_MAX];
+    int i, n, version = ACF_CACHE_VERSION;
+    FILE *h;
+
+    for (i=0, n=0; i<count; i++)
+        if (entries[i].parsed) n++;
+
+    if (!(h = fopen(cachepath(buffer, ACF_CACHE), "wb")))
+        return;		/* Silently fail - e.g. read-only scenery package */
+    fwrite(ACF_CACHE_MAGIC, 4, 1, h);
+    fwrite(&version, sizeof(int), 1, h);
+    fwrite(&n, sizeof(int), 1, h);
+    for (i=0; i<count; i++)
+        if (entries[i].parsed)
+            fwrite(entries + i, sizeof(acf_entry_t), 1, h);
+    if (ferror(h) | fclose(h))
+    {
+        remove(buffer);		/* Don't leave a partial file behind */
+        xplog("Can't write ACF cache");
+    }
+}
+
+
+static char *cachepath(char *buffer, const char *name)
+{
+    strcpy(buffer, pkgpath);
+    strcat(buffer, "/");
+    strcat(buffer, name);
+    return buffer;
+}
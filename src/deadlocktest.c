@@ -0,0 +1,189 @@
+/*
+ * GroundTraffic
+ *
+ * (c) Jonathan Harris 2013
+ *
+ * Licensed under GNU LGPL v2.1.
+ */
+
+/* Standalone check of deadlock() on hand-built graphs of routes waiting for each other's conflict zones.
+ * Build and run with "make -f Makefile.lin deadlocktest". Needs the X-Plane SDK headers but not X-Plane. */
+
+#include "groundtraffic.h"
+
+#define MAX_ROUTES 10000	/* Longest cycle to check */
+
+static route_t routes[MAX_ROUTES];
+static collision_t collisions[MAX_ROUTES];	/* The collision that each route is waiting for */
+static zone_t zones[MAX_ROUTES];
+static int failures = 0;
+static long tests = 0;
+
+
+/* Start afresh with n routes that aren't waiting for anything, with line numbers shuffled so that the lowest isn't
+ * in any particular place in a cycle */
+static void reset(int n)
+{
+    int i;
+
+    memset(routes, 0, n * sizeof(route_t));
+    memset(collisions, 0, n * sizeof(collision_t));
+    memset(zones, 0, n * sizeof(zone_t));
+    for (i = 0; i < n; i++)
+        routes[i].lineno = i + 1;
+    for (i = n-1; i > 0; i--)
+    {
+        int j = rand() % (i + 1), lineno = routes[i].lineno;
+        routes[i].lineno = routes[j].lineno;
+        routes[j].lineno = lineno;
+    }
+}
+
+/* Route a waits for route b, which holds the zone that a wants */
+static void waits(int a, int b)
+{
+    collisions[a].route = routes + b;
+    collisions[a].zone = zones + a;
+    zones[a].holder = routes + b;
+    routes[a].state.collision = collisions + a;
+}
+
+static void check(const char *what, int n, route_t *got, route_t *expected)
+{
+    tests++;
+    if (got != expected)
+    {
+        printf("FAIL %s, %d routes: deadlock() returned route %d, should be %d\n", what, n,
+               got ? (int) (got - routes) : -1, expected ? (int) (expected - routes) : -1);
+        failures++;
+    }
+}
+
+/* Number of routes that can follow the chain of routes that they're waiting for back to themselves */
+static int count_cycled(int n)
+{
+    int i, steps, count = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        route_t *other = routes + i;
+        for (steps = 0; (other = waitingfor(other, other->state.collision)) && other != routes + i && steps < n; steps++);
+        if (other == routes + i)
+            count++;
+    }
+    return count;
+}
+
+
+/* Chains that end at a route that's free to move on aren't deadlocks */
+static void test_chains(void)
+{
+    int n;
+
+    for (n = 2; n <= 5; n++)
+    {
+        int i;
+
+        reset(n);
+        for (i = 1; i < n-1; i++)
+            waits(i, i+1);
+        check("chain", n, deadlock(routes, routes + 1), NULL);
+
+        /* Last route is a plane, or collisions aren't known yet, so polls rather than waits */
+        routes[n-1].state.collision = (collision_t*) -1;
+        check("chain to polling route", n, deadlock(routes, routes + 1), NULL);
+
+        /* Last route waits for the first, but the first has since released the zone */
+        waits(n-1, 0);
+        zones[n-1].holder = NULL;
+        check("chain to released zone", n, deadlock(routes, routes + 1), NULL);
+    }
+}
+
+
+/* A cycle of n routes, closed by each route in turn. deadlock() should find it and pick the same victim whichever
+ * route closes it. The victim then goes regardless - as iscollision() does, it steals the zone that it was waiting
+ * for and stops waiting - which should leave no cycle. */
+static void test_cycle(int n)
+{
+    route_t *victim = routes;
+    int closer, i;
+
+    reset(n);
+    for (i = 0; i < n; i++)
+        if (routes[i].lineno < victim->lineno)
+            victim = routes + i;
+
+    for (closer = 0; closer < n; closer++)
+    {
+        for (i = 0; i < n; i++)
+            if (i != closer)
+                waits(i, (i+1) % n);
+        routes[closer].state.collision = NULL;	/* Not waiting yet - it's deciding whether to */
+        check("cycle", n, deadlock(routes + closer, routes + (closer+1) % n), victim);
+    }
+
+    /* Cycle is closed and the victim has been told to go regardless */
+    waits(n-1, 0);
+    tests++;
+    if (count_cycled(n) != n)
+    {
+        printf("FAIL cycle, %d routes: only %d of them are in it\n", n, count_cycled(n));
+        failures++;
+    }
+
+    /* Victim steals the zone and goes */
+    i = victim - routes;
+    zones[i].holder = victim;
+    victim->state.collision = NULL;
+    tests++;
+    if (count_cycled(n))
+    {
+        printf("FAIL cycle, %d routes: %d routes still deadlocked after victim went\n", n, count_cycled(n));
+        failures++;
+    }
+    for (i = 0; i < n; i++)
+        if (routes + i != victim)
+            check("broken cycle", n, deadlock(routes + i, waitingfor(routes + i, routes[i].state.collision)), NULL);
+}
+
+
+/* A route about to wait for a member of a cycle that doesn't include it, but that includes routes with lower line
+ * numbers. That cycle is found and broken by its own members, so this isn't a new deadlock. */
+static void test_tail(int tail, int n)
+{
+    int i;
+
+    reset(tail + n);
+    for (i = 0; i < n; i++)
+        waits(i, (i+1) % n);
+    for (i = n; i < n + tail - 1; i++)
+        waits(i, i+1);
+    waits(n + tail - 1, 0);
+    routes[n].state.collision = NULL;
+    check("tail into another cycle", tail + n, deadlock(routes + n, tail > 1 ? routes + n + 1 : routes), NULL);
+}
+
+
+int main(void)
+{
+    static const int cycles[] = { 2, 3, 4, 5, 7, 16, 100, 1000, MAX_ROUTES };
+    int i, tail;
+
+    srand(1);
+    test_chains();
+    for (i = 0; i < sizeof(cycles) / sizeof(cycles[0]); i++)
+        test_cycle(cycles[i]);
+    for (tail = 1; tail <= 10; tail++)
+        for (i = 0; i < 6; i++)
+            test_tail(tail, cycles[i]);
+    test_tail(MAX_ROUTES/2, MAX_ROUTES/2);
+
+    printf("%ld tests\n", tests);
+    if (failures)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
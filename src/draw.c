@@ -20,88 +20,272 @@ int drawcumul  = 0;		/* clock time taken drawing [us] */
 int drawframes = 0;		/* over cumulative number of frames */
 #endif
 
+/* Threads that share out the pose phase of drawcallback() with the main thread */
+static worker_t poseworkers[MAX_POSE_THREADS];	/* [0] unused - it's the main thread */
+static int nposethreads = 0;	/* Including the main thread, or 0 if the main thread works alone */
+static signal_t posesignal;	/* Protects posenext, posecount, posefollow and posebusy */
+static int posenext = INT_MAX;	/* Index of the next route to hand out. >= posecount when there's no work */
+static int posecount = 0;	/* End of this pass's routes - index space is airport's routes followed by its pool of cars */
+static int posefollow = 0;	/* Whether this pass is trains' cars following their heads' trails */
+static int posebusy = 0;	/* Number of chunks of routes currently being worked on */
+static unsigned int tierframe = 0;	/* For staggering updates of routes that are just out of range */
+
 /* In this file */
-static void bez(XPLMDrawInfo_t *drawinfo, point_t *p1, point_t *p2, point_t *p3, float mu);
+static collision_t* checkcollision(route_t *route, int check_routes);
+static void unwait(route_t *route);
+static inline void setsegment(route_t *route);
+static void flowhighway(const route_t *route, float now, float view_x, float view_z);
+static inline int flowcar(route_t *route, float now);
+static inline float cardistance(const route_t *route, float station);
+static inline int inspans(const highway_t *highway, float distance);
+static inline float carstation(const highway_t *highway, int car, int *object);
+static void takecars(const route_t *route, float from, float to);
+static route_t *takecar(route_t *holder, int car, float station);
+static int growcars(void);
+static void freecar(route_t *route);
+static void parkcar(route_t *route);
+static void updatecars(float now, XPLMProbeInfo_t *probeinfo);
+static float nextevent(route_t *route, float now, float route_now, int *tod, unsigned int *dow);
+static void setdatarefs(const setcmd_t *setcmd, float start, int pausetime);
+static void seekroute(route_t *route, float route_now);
+static void trackroute(route_t *route, float now, float route_now, int posed, XPLMProbeInfo_t *probeinfo);
+static inline int needpose(const route_t *route, float now, float view_x, float view_z, unsigned int frame);
+static inline float collision_y(const route_t *route, float progress);
+static void *pose_task(void *arg);
+static void posepass(int first, int last, int follow);
+static void posechunks(void);
+static void poseroutes(int first, int last);
+static inline void poseroute(route_t *route, turnqueue_t *queue);
+static inline void queueturn(turnqueue_t *queue, route_t *route, const point_t *p1, const point_t *p2, const point_t *p3, float mu, float steer_sign, float steer_base);
+static void flushturns(turnqueue_t *queue);
+static inline void finishpose(route_t *route, float dx, float dz);
+static void recordtrail(route_t *route, float dx, float dz);
+static void followtrail(route_t *route);
+
+
+/* Reserve the conflict zones on the path segment that we're setting off along. Zones that another live route holds
+ * are left to it, unless steal is set because we're going regardless of other routes and it's at our altitude - in
+ * which case the routes waiting for it re-check. A holder at a different altitude isn't in our way, so keeps its zone. */
+static void reserve_zones(route_t *route, int steal)
+{
+    path_t *node;
+    reservation_t *r;
+    collision_t *c;
 
+    if (!airport.done_collisions || route->parent || route->highway)
+        return;
+    if (route->nreserved >= MAX_RESERVED)
+    {
+        /* Long train on short segments. Give up the zones that the tail is furthest through */
+        node = route->path + route->reserved[0].node;
+        for (c = node->collisions; c < node->collisions + node->ncollisions; c++)
+            if (c->zone->holder == route)
+                c->zone->holder = NULL;
+        memmove(route->reserved, route->reserved + 1, --route->nreserved * sizeof(reservation_t));
+        wake_waiters(route);
+    }
+    r = route->reserved + route->nreserved++;
+    r->node = route->direction>0 ? route->last_node : route->next_node;
+    r->direction = route->direction;
+    r->start = route->last_odometer;
+    r->length = route->path[r->node].length;
+    node = route->path + r->node;
+    for (c = node->collisions; c < node->collisions + node->ncollisions; c++)
+        if (!c->zone->holder || c->zone->holder == route || !route_live(&airport, c->zone->holder))
+            c->zone->holder = route;
+        else if (steal && fabsf(collision_y(c->zone->holder, c->zone->holder->pose_progress) - collision_y(route, 0)) <= COLLISION_ALT)
+        {
+            wake_waiters(c->zone->holder);
+            c->zone->holder = route;
+        }
+    release_zones(route, 0);	/* Calculate release_at */
+}
 
-static collision_t* iscollision(route_t *route, int tryno)
-{
-    path_t *last_node = route->path + route->last_node;
-    path_t *next_node = route->path + route->next_node;
-    collision_t *c = tryno ? (route->direction>0 ? last_node->collisions : next_node->collisions) : NULL;
-    int planeno;
-    float t = route->next_distance / route->speed;	/* time to next waypoint */;
 
-    if (route->highway) return NULL;	/* Highways aren't subject to collisions */
+/* Release the conflict zones that we and the rest of our train are COLLISION_CLEARANCE beyond, or all of them.
+ * Zones are released in the order that we pass them, so we only need to look again once odometer >= release_at. */
+void release_zones(route_t *route, int all)
+{
+    float clearance = COLLISION_CLEARANCE + route->trainlength;
+    int released = 0;
 
-    /* Route collisions */
-    while (c)
+    route->release_at = FLT_MAX;
+    while (route->nreserved)
     {
-        path_t *c_end_node;
+        reservation_t *r = route->reserved;
+        path_t *node = route->path + r->node;
+        collision_t *c;
+
+        for (c = node->collisions; c < node->collisions + node->ncollisions; c++)
+            if (c->zone->holder == route)
+            {
+                float release = r->start + (r->direction>0 ? c->at : 1 - c->at) * r->length + clearance;
+                if (all || route->odometer >= release)
+                {
+                    c->zone->holder = NULL;
+                    released = -1;
+                }
+                else if (release < route->release_at)
+                    route->release_at = release;
+            }
 
-	/* Avoid immediate deadlock if we're just enabled/activated */
-        if (c->route->last_node == c->route->next_node)
+        if (!all && route->odometer < r->start + r->length + clearance)
         {
-            c = c->next;
-            continue;
+            /* Zones on later segments are further ahead */
+            if (r->start + r->length + clearance < route->release_at)
+                route->release_at = r->start + r->length + clearance;
+            break;
         }
+        memmove(route->reserved, route->reserved + 1, --route->nreserved * sizeof(reservation_t));
+    }
+    if (released)
+        wake_waiters(route);
+}
+
 
-        c_end_node = c->route->path + (c->node+1 >= c->route->pathlen ? 0 : c->node+1);	/* Node at end of colliding segment */
-        if(route->direction>0 && c->route->direction>0 && next_node->waypoint.lat == c_end_node->waypoint.lat && next_node->waypoint.lon == c_end_node->waypoint.lon)
+/* Have the routes that are waiting for us re-check for collisions at their next opportunity, i.e. later this frame if
+ * they come after us in the list of routes, otherwise next frame. They stay on our list until they re-check. */
+void wake_waiters(route_t *route)
+{
+    route_t *waiter;
+
+    for (waiter = route->waiters; waiter; waiter = waiter->nextwaiter)
+        waiter->next_time = last_frame;		/* which is now */
+}
+
+
+/* Take ourselves off the list of routes waiting for the route that we were waiting for */
+static void unwait(route_t *route)
+{
+    collision_t *c = route->state.collision;
+    route_t **waiter;
+
+    if (!c || c == (collision_t*) -1)
+        return;
+    for (waiter = &c->route->waiters; *waiter; waiter = &(*waiter)->nextwaiter)
+        if (*waiter == route)
         {
-            /* Co-located end nodes */
+            *waiter = route->nextwaiter;
+            break;
+        }
+    route->nextwaiter = NULL;
+}
 
-            /* Have to wait if he's sitting on the co-located end node */
-            if (c->route->last_node == c->node+1 &&
-                (c->route->state.dataref || c->route->state.waiting || c->route->state.collision ||
-                 (c->route->state.paused && route->next_time + t <= c->route->next_time + COLLISION_INTERVAL))) /* Our next_time hasn't yet been updated yet so ~= now. His next_time is the time he will unpause. */
-            {
-                route->deadlocked = COLLISION_TIMEOUT;	/* Wait potentially forever */
-                return c;
-            }
 
-            /* Have to wait if he will wait when he reaches the co-located end node, or if we'll get there too early */
-            /* We don't check whether he *might* wait for a collision - gets too complicated */
-            if (c->route->last_node == c->node &&	/* On colliding segment */
-                !(c->route->state.dataref || c->route->state.waiting || c->route->state.collision || c->route->state.paused) &&	/* He's not waiting at previous node */
-                (c_end_node->whenrefs || c_end_node->attime[0] != INVALID_AT ||
-                 route->next_time + t <= c->route->next_time + COLLISION_INTERVAL + c_end_node->pausetime)) /* Our route->next_time hasn't yet been updated yet so ~= now */
-            {
-                route->deadlocked = COLLISION_TIMEOUT;	/* Wait potentially forever */
-                return c;
-            }
+#ifdef DO_BENCHMARK
+/* Number of routes in cycles of routes waiting for each other that aren't being broken, i.e. that have no member that
+ * will go regardless at its next check. Should always be 0. */
+int count_deadlocked(void)
+{
+    int i, steps, count = 0;
+
+    for (i = 0; i < airport.nleaders; i++)
+    {
+        route_t *route = airport.routetbl + i, *other = route;
+        int breaking = route->deadlocked;
+
+        for (steps = 0; (other = waitingfor(other, other->state.collision)) && other != route && steps < airport.nroutes; steps++)
+            breaking |= other->deadlocked;
+        if (other == route && !breaking)
+            count++;
+    }
+    return count;
+}
+#endif
+
+
+/* Is the next path segment clear? Returns the collision that we have to wait for, or NULL if we can go.
+ * If we can go, and aren't otherwise waiting, reserves the segment's conflict zones.
+ * Detects and breaks deadlocks between routes waiting for each other's conflict zones. */
+static collision_t* iscollision(route_t *route)
+{
+    collision_t *c;
+    route_t *other, *victim;
+    int regardless = route->deadlocked;
+
+    unwait(route);
+    c = checkcollision(route, !regardless);
+    route->deadlocked = 0;
+    if ((other = waitingfor(route, c)) && (victim = deadlock(route, other)))
+    {
+        airport.deadlocks++;
+        if (victim == route)
+        {
+            c = checkcollision(route, 0);	/* Go regardless of other routes */
+            regardless = -1;
         }
         else
         {
-            /* Paths cross */
-
-            if ((c->route->direction>0 ? c->route->last_node : c->route->next_node) == c->node &&	/* On colliding segment */
-                /* No point waiting for a route that is itself waiting for any reason. He'll re-check on exit from wait. */
-                !(c->route->state.dataref||c->route->state.waiting||c->route->state.collision||c->route->state.paused) &&
-                /* At similar altitude? */
-                fabsf(c->route->drawinfo->y - route->drawinfo->y) <= COLLISION_ALT)
-            {
-                route->deadlocked = tryno;		/* Collision */
-                return c;
-            }
+            victim->deadlocked = -1;		/* Go regardless of other routes at its next check */
+            victim->next_time = last_frame;	/* which is now */
         }
-        c = c->next;
+    }
+
+    if (!c && !(route->state.paused || route->state.waiting || route->state.dataref))
+        reserve_zones(route, regardless);
+    else if (c && c != (collision_t*) -1)
+    {
+        /* Get notified when he releases the conflict zone or finishes loading */
+        route->nextwaiter = c->route->waiters;
+        c->route->waiters = route;
+    }
+    return c;
+}
+
+
+static collision_t* checkcollision(route_t *route, int check_routes)
+{
+    path_t *last_node = route->path + route->last_node;
+    path_t *next_node = route->path + route->next_node;
+    path_t *node = route->direction>0 ? last_node : next_node;
+    collision_t *c = (check_routes && airport.done_collisions) ? node->collisions : NULL;
+    int planeno;
+    float t = route->next_distance / route->speed;	/* time to next waypoint */;
+
+    if (route->highway) return NULL;	/* Highways aren't subject to collisions */
+    if (check_routes && !airport.done_collisions)
+        return (collision_t*) -1;	/* Don't know yet where our path crosses other routes', so hold until we do */
+
+    /* Route collisions */
+    for (; c && c < node->collisions + node->ncollisions; c++)
+    {
+        /* Ignore routes in cells that are out of range */
+        if (!route_live(&airport, c->route))
+            continue;
+
+        /* Route is still loading so we don't know where it will be when it starts - assume the worst */
+        if (!c->route->ready)
+            return c;
+
+        /* Have to wait while he occupies the conflict zone, unless he's at a different altitude */
+        if (c->zone->holder == c->route && fabsf(collision_y(c->route, c->route->pose_progress) - collision_y(route, 0)) <= COLLISION_ALT)
+            return c;
     }
 
     /* Plane collisions */
     for (planeno=0; planeno<count_planes(); planeno++)
     {
         point_t *p;
-        int i, j;
+        float x2[4], z2[4], x3[4], z3[4];
+        int i, j, mask;
 
-        if (!(p = get_plane_footprint(planeno, t))) continue;
+        if (!(p = get_plane_footprint(planeno, t, &last_node->p, &next_node->p))) continue;
 
         /* If our waypoint is inside the exclusion region then get our object out of the way! */
         if (inside(&last_node->p, p, 4)) return 0;
 
         for (i=0, j=3; i<4; j=i++)
-            if (intersect(&last_node->p, &next_node->p, p+i, p+j))
-                return (collision_t*) -1;	/* Next edge intersects this plane's footprint */
+        {
+            x2[i] = p[i].x;  z2[i] = p[i].z;
+            x3[i] = p[j].x;  z3[i] = p[j].z;
+        }
+        mask = intersect4(last_node->p.x, last_node->p.z, next_node->p.x, next_node->p.z, x2, z2, x3, z3);
+#ifdef DEBUG
+        for (i=0, j=3; i<4; j=i++)
+            assert (((mask >> i) & 1) == intersect(&last_node->p, &next_node->p, p+i, p+j));
+#endif
+        if (mask)
+            return (collision_t*) -1;	/* Next edge intersects one of this plane's footprint's edges */
     }
 
     return NULL;
@@ -124,463 +308,891 @@ static void drawroutes()
 {
     float view_x, view_y, view_z;
     float dataref_values[dataref_count];
-
+    int i;
 
     view_x=XPLMGetDataf(ref_view_x);
     view_y=XPLMGetDataf(ref_view_y);
     view_z=XPLMGetDataf(ref_view_z);
 
-    route_t *drawroute=airport.routes;
-    while (drawroute)
+    /* Airport's routes followed by the pool of highway cars, in the same order as the pose phase */
+    for (i = 0; i < airport.nroutes + airport.ncars; i++)
     {
+        route_t *drawroute = i < airport.nroutes ? airport.routetbl + i : airport.cars + (i - airport.nroutes);
+
         /* Have to check draw range every frame since "now" isn't updated while sim paused */
-        if (indrawrange(drawroute->drawinfo->x-view_x, drawroute->drawinfo->y-view_y,
-                        drawroute->drawinfo->z-view_z, drawroute->object.drawlod * lod_factor)) {
+        if (drawroute->ready && drawroute->posed &&	/* Not loaded yet, or cell or route is out of range */
+            (!drawroute->object.drawlod ||	/* LOD not calculated yet */
+             indrawrange(drawroute->drawinfo->x-view_x, drawroute->drawinfo->y-view_y,
+                         drawroute->drawinfo->z-view_z, drawroute->object.drawlod * lod_factor))) {
                 get_dataref_values(drawroute, dataref_values);
                 XPLMInstanceSetPosition(drawroute->instance_ref, drawroute->drawinfo, dataref_values);
             }
+    }
+}
 
-        drawroute=drawroute->next;
+
+/* Look up the path segment from last_node to next_node. Segments are stored in the forwards direction */
+static inline void setsegment(route_t *route)
+{
+    if (route->direction > 0)
+    {
+        const path_t *segment = route->path + route->last_node;
+        route->next_heading = segment->heading;
+        route->next_distance = segment->length;
+        route->next_dx = segment->dx;
+        route->next_dz = segment->dz;
+    }
+    else
+    {
+        const path_t *segment = route->path + route->next_node;
+        route->next_heading = segment->heading > 0 ? segment->heading - 180 : segment->heading + 180;
+        route->next_distance = segment->length;
+        route->next_dx = -segment->dx;
+        route->next_dz = -segment->dz;
     }
 }
 
 
-/* Main update and draw loop */
-int drawcallback()                                                           // nst0022 2.2
+/* Move a highway's traffic along, find the stretches of its path where cars might be within draw range, and give the
+ * cars that have come into those stretches a route from the pool. Called once per frame for each highway. */
+static void flowhighway(const route_t *route, float now, float view_x, float view_z)
 {
-    double airport_x, airport_y, airport_z;
-    float now;
-    route_t *route;
-    int tod=-1;
-    unsigned int dow=0;
-    XPLMProbeInfo_t probeinfo;
-#ifdef DO_BENCHMARK
-    struct timeval t1, t2;
-    gettimeofday(&t1, NULL);		/* start */
-#endif
+    highway_t *highway = route->highway;
+    float length = route->path[route->pathlen-1].cumul;
+    float range = 0;
+    int i;
+
+    if (highway->flow_time && length > 0)
+    {
+        /* fmodf() since time jumps and goes backwards in replay */
+        highway->flow = fmodf(highway->flow + route->speed * (now - highway->flow_time), length);
+        if (highway->flow < 0) highway->flow += length;
+    }
+    highway->flow_time = now;
 
-    assert (airport.state == active);
+    highway->nspans = 0;
+    if (!route_live(&airport, route))
+        return;		/* Cars aren't loaded */
 
-    XPLMWorldToLocal(airport.tower.lat, airport.tower.lon, airport.tower.alt, &airport_x, &airport_y, &airport_z);
-    if (airport.p.x != airport_x || airport.p.y != airport_y || airport.p.z != airport_z)
+    for (i=0; i < highway->obj_count; i++)
     {
-        /* OpenGL projection has shifted */
-        airport.p.x=airport_x;  airport.p.y=airport_y;  airport.p.z=airport_z;
-        maproutes(&airport);
+        float drawlod = highway->holders[i]->object.drawlod;
+        if (!drawlod) drawlod = DEFAULT_DRAWLOD;	/* LOD not calculated yet */
+        if (drawlod * lod_factor > range) range = drawlod * lod_factor;
     }
 
-    // nst0022 2.1  The following 'if' only works with xplm_Phase_Modern3D, for all other it needs to be commented out,
-    //              otherwise lod_factor gets not set, so there would be no objects drawn at all
-    //              Unclear, why this is necessary in the first place (3D rendering type: 0 = normal, 1 = reflections in water)
-    //if (!XPLMGetDatai(ref_rentype))
+    for (i=0; i < route->pathlen-1; i++)
     {
-        int width;
-        XPLMGetScreenSize(&width, NULL);
-        lod_factor = (float) width / lod_bias;	/* Screen size can change while paused, so need to recalculate once per frame */
-#ifdef DO_BENCHMARK
-        drawframes += 1;
-#endif
+        const path_t *node = route->path + i;
+        float t = fminf(fmaxf((view_x - node->p.x) * node->dx + (view_z - node->p.z) * node->dz, 0), node->length);
+        float x = node->p.x + t * node->dx - view_x, z = node->p.z + t * node->dz - view_z;
 
-        /* draw route paths */
-        if (airport.drawroutes)
+        if (x*x + z*z > range*range)
+            continue;
+        else if (highway->nspans && highway->spans[highway->nspans-1][1] == node->cumul)
+            highway->spans[highway->nspans-1][1] = node[1].cumul;	/* Carries on from the previous segment */
+        else if (highway->nspans < MAX_HIGHWAY_SPANS)
         {
-#if 0  /// HT
-#ifdef DEBUG
-            int planeno;
-#endif
-            GLint view[4] = { 0 };
-
-            XPLMSetGraphicsState(0, 0, 0,   0, 1,   0, 0);
-            glLineWidth(1.5);
-
-            XPLMGetScreenSize(view+2, view+3);	/* Real viewport reported by GL_VIEWPORT will be larger than physical screen if FSAA enabled */
-            drawdebug3d(-1, view);
-
-#ifdef DEBUG
-            /* Draw AI plane positions */
-            glColor4f(0,0,0,0.25f);
-            glBegin(GL_QUADS);
-            for (planeno=0; planeno<count_planes(); planeno++)
-            {
-                point_t *p;
-                int i;
-
-                if ((p = get_plane_footprint(planeno, 5.f)))	/* Display 5 seconds ahead */
-                    for (i=0; i<4; i++)
-                        glVertex3fv(&(p[i].x));
-            }
-            glEnd();
-#endif
-#endif /// HT
+            highway->spans[highway->nspans][0] = node->cumul;
+            highway->spans[highway->nspans++][1] = node[1].cumul;
         }
+        else
+            highway->spans[highway->nspans-1][1] = node[1].cumul;	/* Run out - draw the stretches in between too */
     }
 
-    /* We can be called multiple times per frame depending on shadow settings -
-     * ("sim/graphics/view/world_render_type" = 0 if normal draw, 3 if shadow draw (which precedes normal))
-     * So skip calculations and just draw if we've already run the calculations for this frame. */
-    if ((now = XPLMGetDataf(ref_monotonic)) == last_frame)
+    /* Give back the cars that have left the spans first, so that the cars coming into them can re-use their instances */
+    for (i=0; i < airport.ncars; i++)
+        if (airport.cars[i].ready && airport.cars[i].highway == highway &&
+            !inspans(highway, cardistance(route, airport.cars[i].highway_offset)))
+            parkcar(airport.cars + i);
+
+    /* A car's distance along the path is its station plus the flow, wrapped round, so each span holds two runs of stations */
+    for (i=0; i < highway->nspans; i++)
     {
-        drawroutes();
-#ifdef DO_BENCHMARK
-        gettimeofday(&t2, NULL);		/* stop */
-        drawcumul += (t2.tv_sec-t1.tv_sec) * 1000000 + t2.tv_usec - t1.tv_usec;
-#endif
-#ifdef DEBUG
-        if (!XPLMGetDatai(ref_rentype)) last_frame = 0;	/* In DEBUG recalculate positions once per frame for easier debugging */
-#endif
-        return 1;
+        takecars(route, highway->spans[i][0] - highway->flow, highway->spans[i][1] - highway->flow);
+        takecars(route, highway->spans[i][0] - highway->flow + length, highway->spans[i][1] - highway->flow + length);
     }
-    last_frame = now;
+}
 
-    /* Update and draw */
-    is_night = (int) (XPLMGetDataf(ref_night) + 0.67f);
-    probeinfo.structSize = sizeof(XPLMProbeInfo_t);
 
-    for(route=airport.routes; route; route=route->next)
+/* Place a highway car at its station in the highway's flow. Returns whether it might be within draw range */
+static inline int flowcar(route_t *route, float now)
+{
+    float distance = cardistance(route, route->highway_offset);
+
+    if (!inspans(route->highway, distance))
+        return 0;
+
+    if (distance < route->path[route->last_node].cumul)
     {
-        path_t *last_node, *next_node;
-        float progress;
-        float route_now = now - route->object.lag;	/* Train objects are drawn in the past */
+        /* Wrapped round to the start, or gone back in replay */
+        route->last_node = 0;
+        route->next_y = INVALID_ALT;	/* Discontinuity so reset */
+    }
+    while (route->last_node < route->pathlen-2 && route->path[route->last_node+1].cumul <= distance)
+        route->last_node++;
+    route->next_node = route->last_node + 1;
+    route->direction = 1;
+    setsegment(route);
+    route->last_distance = route->path[route->last_node].cumul;
+    route->last_time = now - (distance - route->last_distance) / route->speed;
+    route->next_time = route->last_time + route->next_distance / route->speed;
+    return -1;
+}
 
-        if (route_now >= route->next_time && !route->state.frozen)
-        {
-            setcmd_t *setcmd = NULL;
 
-            if (route->state.waiting)
-            {
-                /* We don't get notified when time-of-day changes in the sim, so poll once a minute */
-                int i;
-                if (!dow)
-                {
-                    /* Get current day-of-week. FIXME: This is in user's timezone, not the airport's. */
-                    struct tm tm = { 0, 0, 12, XPLMGetDatai(ref_doy)+1, 0, year };
-                    dow = (mktime(&tm) == -1) ? DAY_SUN : 1 << tm.tm_wday;
-                }
-                if (tod < 0) tod = (int) (XPLMGetDataf(ref_tod)/60);
-                for (i=0; i<MAX_ATTIMES; i++)
-                {
-                    if (route->path[route->last_node].attime[i] == INVALID_AT)
-                        break;
-                    else if ((route->path[route->last_node].attime[i] == tod) &&
-                             (route->path[route->last_node].atdays & dow))
-                    {
-                        route->state.waiting = 0;
-                        route->state.collision = iscollision(route, COLLISION_TIMEOUT);	/* Re-check for collision */
-                        break;
-                    }
-                }
-                /* last and next were calculated when we originally hit this waypoint */
-            }
-            else if (route->state.dataref)
-            {
-                whenref_t *whenref = route->path[route->last_node].whenrefs;
+/* Distance along a highway's path of the car at station */
+static inline float cardistance(const route_t *route, float station)
+{
+    float distance = station + route->highway->flow;
 
-                while (whenref)
-                {
-                    float val;
-                    extref_t *extref = whenref->extref;
-
-                    if (extref->type == xplmType_Mine)
-                    {
-                        val = userrefcallback(extref->ref);
-                    }
-                    else if (whenref->idx < 0)
-                    {
-                        /* Not an array */
-                        if (extref->type & xplmType_Float)
-                            val = XPLMGetDataf(extref->ref);
-                        else if (extref->type & xplmType_Double)
-                            val = XPLMGetDatad(extref->ref);
-                        else if (extref->type & xplmType_Int)
-                            val = XPLMGetDatai(extref->ref);
-                        else
-                            val = 0;	/* Lookup failed or otherwise unusable */
-                    }
-                    else if (extref->type & xplmType_FloatArray)
-                    {
-                        XPLMGetDatavf(extref->ref, &val, whenref->idx, 1);
-                    }
-                    else if (extref->type & xplmType_IntArray)
-                    {
-                        int ival;
-                        XPLMGetDatavi(extref->ref, &ival, whenref->idx, 1);
-                        val = ival;
-                    }
-                    else
-                    {
-                        val = 0;	/* Lookup failed or otherwise unusable */
-                    }
-
-                    if ((val >= whenref->from) && (val <= whenref->to))
-                        whenref = whenref->next;
-                    else
-                        break;		/* fail */
-                }
+    if (distance >= route->path[route->pathlen-1].cumul)
+        distance -= route->path[route->pathlen-1].cumul;
+    return distance;
+}
 
-                if (!whenref)
-                {
-                    /* All passed */
-                    route->state.dataref = 0;
-                    route->state.collision = iscollision(route, COLLISION_TIMEOUT);	/* Re-check for collision */
-                    /* last and next were calculated when we originally hit this waypoint */
-                }
-            }
-            else if (route->state.paused)
-            {
-                route->state.paused = 0;
-                route->state.collision = iscollision(route, COLLISION_TIMEOUT);	/* Re-check for collision */
-                /* last and next were calculated when we originally hit this waypoint */
-            }
-            else if (route->state.collision)
-            {
-                route->state.collision = iscollision(route, route->deadlocked-1);	/* Break deadlock on timeout */
-                /* last and next were calculated when we originally hit this waypoint */
-            }
-            else	/* next waypoint */
-            {
-#ifdef DO_BENCHMARK
-                if (route == airport.firstroute)
-                {
-                    drawcumul = 0;
-                    drawframes= XPLMGetDatai(ref_rentype) ? 0 : 1;
-                }
-#endif
-                route->last_node = route->next_node;
-                route->next_node += route->direction;
-                if (!route->last_node || (route->highway && route->next_node >= route->pathlen))
-                    route->last_distance = 0;	/* reset distance travelled to prevent growing stupidly large */
-                else if (route->state.backingup)
-                    route->last_distance -= route->next_distance;
-                else
-                    route->last_distance += route->next_distance;
-                route->distance = route->last_distance;
 
-                if (route->highway && !route->next_time)
-                {
-                    /* reset highway route */
-                    int i;
-                    float path_cumul = 0;
-
-                    route->distance = route->highway_offset;
-                    route->last_distance = 0;
-                    for (i=1; i<route->pathlen; i++)
-                    {
-                        path_t *node = route->path+i, *prev = route->path+i-1;
-                        path_cumul += hypotf(node->p.x - prev->p.x, node->p.z - prev->p.z);
-                        if (path_cumul >= route->highway_offset)
-                        {
-                            route->next_time = now - (route->highway_offset - route->last_distance) / route->speed;
-                            route->last_node = i-1;
-                            route->next_node = i;
-                            break;
-                        }
-                        else
-                        {
-                            route->last_distance = path_cumul;
-                        }
-                    }
-                }
-                else if (route->path[route->last_node].flags.reverse)
-                {
-                    route->direction = -1;
-                    route->next_node = route->pathlen-2;
-                }
-                else if (route->next_node >= route->pathlen)
-                {
-                    /* At end of route */
-                    if (route->highway)
-                    {
-                        route->last_node = 0;	/* jump back to start */
-                        route->next_node = 1;
-                        route->next_y = INVALID_ALT;	/* Discontinuity so reset */
-                    }
-                    else
-                    {
-                        route->next_node = 0;	/* head on to start */
-                    }
-                }
-                else if (route->next_node < 0)
-                {
-                    /* Back at start of route - start again */
-                    route->direction = 1;
-                    route->next_node = 1;
-                }
-                last_node = route->path + route->last_node;
-                next_node = route->path + route->next_node;
+/* Is a distance along a highway's path within one of the stretches that might be within draw range this frame? */
+static inline int inspans(const highway_t *highway, float distance)
+{
+    int i;
 
-                /* Assume distances are too small to care about earth curvature so just calculate using OpenGL coords */
-                route->next_heading = R2D(atan2f(next_node->p.x - last_node->p.x, last_node->p.z - next_node->p.z));
-                route->next_distance = sqrtf((next_node->p.x - last_node->p.x) * (next_node->p.x - last_node->p.x) +
-                                             (next_node->p.z - last_node->p.z) * (next_node->p.z - last_node->p.z));
+    for (i=0; i < highway->nspans; i++)
+        if (distance >= highway->spans[i][0] && distance <= highway->spans[i][1])
+            return -1;
+    return 0;
+}
 
-                if (!route->parent)
-                {
-                    if (last_node->whenrefs)
-                        route->state.dataref = 1;
-                    if (last_node->attime[0] != INVALID_AT)
-                        route->state.waiting = 1;
-                    if (last_node->pausetime)
-                        route->state.paused = 1;
-                    setcmd = last_node->setcmds;
-                    if (last_node->flags.backup)
-                    {
-                        if (last_node->pausetime)	/* A */
-                        {
-                            /* Backing up after pause */
-                            route->state.backingup = 1;
-                            route->state.forwardsa = 1;
-                        }
-                        else						/* Y */
-                        {
-                            /* Backing up before pause */
-                            route->state.forwardsb = 1;
-                        }
-                    }
-                    else
-                    {
-                        if (!route->state.forwardsa)			/* !Q */
-                        {
-                            route->state.backingup = 0;
-                            route->state.forwardsb = 0;
-                        }
-                        if (!route->state.backingup && !route->state.forwardsb)	/* !B */
-                        {
-                            route->state.forwardsa = 0;
-                        }
-                    }
-                    route->state.collision = iscollision(route, COLLISION_TIMEOUT);
-                }
-            }
 
-            last_node = route->path + route->last_node;
-            next_node = route->path + route->next_node;
+/* Each virtual car's object and station are derived from a hash of its number, so needn't be stored.
+ * Returns the car's station - its distance ahead of the highway's flow [m]. The first car is at the highway's start. */
+static inline float carstation(const highway_t *highway, int car, int *object)
+{
+    /* MurmurHash3 finalizer https://github.com/aappleby/smhasher */
+    unsigned int h = highway->seed + car;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    *object = h % highway->obj_count;
+    return car ? highway->spacing * (car + HIGHWAY_VARIANCE * ((h >> 16) / 65536.f - 0.5f)) : 0;
+}
 
-            /* Maintain speed/progress unless there's been a large gap in draw callbacks because we were deactivated / disabled */
-            if (route->highway || (route->last_time && route_now - route->next_time < RESET_TIME))
-                route->last_time = route->next_time;
-            else
-            {
-                route->last_time = now;			/* reset */
-                route_now = route->last_time - route->object.lag;
-            }
 
-            if (route->state.waiting)
-                route->next_time = route->last_time + AT_INTERVAL;
-            else if (route->state.dataref)
-                route->next_time = route->last_time + WHEN_INTERVAL;
-            else if (route->state.paused)
-                route->next_time = route->last_time + last_node->pausetime;
-            else if (route->state.collision)
-                route->next_time = route->last_time + COLLISION_INTERVAL;
-            else if (route->state.forwardsa && !last_node->flags.backup)			/* B */
-            {
-                route->next_distance += route->speed * TURN_TIME;	/* Allow for extra turning distance */
-                route->next_time = route->last_time + route->next_distance / route->speed;
-            }
-            else if (route->state.forwardsb && last_node->flags.backup)	/* Y */
-            {
-                route->last_time += TURN_TIME;	/* Allow for extra turning distance */
-                route->next_time = route->last_time + route->next_distance / route->speed;
-            }
-            else
-                route->next_time = route->last_time + route->next_distance / route->speed;
+/* Give routes from the pool to the highway's cars that aren't already drawn and whose stations are between from and to */
+static void takecars(const route_t *route, float from, float to)
+{
+    highway_t *highway = route->highway;
+    int first = (int) ceilf(from / highway->spacing - HIGHWAY_VARIANCE/2) - 1;
+    int last  = (int) floorf(to / highway->spacing + HIGHWAY_VARIANCE/2) + 1;
+    int car;
+
+    if (first < 0) first = 0;
+    if (last >= highway->ncars) last = highway->ncars - 1;
+    for (car = first; car <= last; car++)
+    {
+        route_t *holder;
+        float station;
+        int object;
 
-            /* Set DataRefs. Need to do this after calculating last_time so use hacky flag */
-            while (setcmd)
-            {
-                userref_t *userref = setcmd->userref;
+        if (highway->drawn[car/8] & (1 << (car%8)))
+            continue;
+        station = carstation(highway, car, &object);
+        holder = highway->holders[object];
+        if (!holder->ready)
+            continue;	/* Object not loaded yet */
 
-                userref->duration = setcmd->duration;
-                userref->slope = setcmd->flags.slope;
-                userref->curve = setcmd->flags.curve;
-                if (setcmd->flags.set2)
-                {
-                    userref->start1 = route->last_time;
-                    userref->start2 = route->last_time + last_node->pausetime - userref->duration;
-                }
-                else if (setcmd->flags.set1)
-                {
-                    userref->start1 = route->last_time;
-                    userref->start2 = 0;
-                }
-                setcmd = setcmd->next;
-            }
+        if (inspans(highway, cardistance(route, station)) && !takecar(holder, car, station))
+            return;	/* Out of memory */
+    }
+}
 
-            /* Force re-probe since we've changed direction */
-            route->next_probe = route_now;
 
-        } // (route_now >= route->next_time && !route->state.frozen)
+/* Take a route from the pool for one of a highway's cars, preferring one that already has an instance of its object.
+ * Returns NULL if out of memory. */
+static route_t *takecar(route_t *holder, int car, float station)
+{
+    highway_t *highway = holder->highway;
+    route_t *route, *empty = NULL, *other = NULL;
+    XPLMInstanceRef instance;
+    int i;
 
-        /* Parent controls state of children */
-        if (route->parent && !route->highway)
+    for (i=0; i < airport.ncars; i++)
+    {
+        route = airport.cars + i;
+        if (route->ready)
+            continue;	/* In use */
+        else if (!route->instance_ref)
         {
-            if ((route->parent->last_time == now) || (route->path[route->pathlen-1].flags.reverse && (!route->parent->last_node || route->parent->last_node==route->pathlen-1)))
-            {
-                /* Parent was reset or at end of a reversible route - line up back in time from it */
-                route->direction = route->parent->direction;
-                route->last_node = route->parent->last_node;
-                route->next_node = route->parent->next_node;
-                route->last_distance = route->parent->last_distance;
-                route->next_distance = route->parent->next_distance;
-                route->distance = route->parent->distance - route->object.lag * route->speed;	/* Negative at first node */
-                route->next_heading = route->parent->next_heading;
-                route->last_time = route->parent->last_time;
-                route->next_time = route->last_time + route->next_distance / route->speed;
-                route->state.frozen = 0;
-            }
-
-            if (route->parent->state.paused||route->parent->state.waiting||route->parent->state.dataref||route->parent->state.collision)
-            {
-                /* Parent is paused */
-                if (!route->state.frozen)
-                {
-                    route->freeze_time = route->parent->last_time;	/* Save time parent started pause */
-                    route->state.frozen = 1;
-                }
-                route_now = route->freeze_time - route->object.lag;
-            }
-            else if (route->state.frozen && !(route->parent->state.paused||route->parent->state.waiting||route->parent->state.dataref||route->parent->state.collision))
-            {
-                /* Parent has just unpaused - maintain spacing */
-                route->last_time += (route->parent->last_time - route->freeze_time);
-                route->next_time += (route->parent->last_time - route->freeze_time);
-                route->state.frozen = 0;
-            }
+            if (!empty) empty = route;
         }
+        else if (route->object.objref == holder->object.objref)
+            break;
+        else if (!other)
+            other = route;
+    }
+    if (i < airport.ncars)
+        ;	/* Found one with a matching instance */
+    else if (empty)
+        route = empty;
+    else if (airport.ncars < airport.maxcars)
+        route = airport.cars + airport.ncars++;
+    else if ((route = other))
+    {
+        XPLMDestroyInstance(route->instance_ref);
+        route->instance_ref = NULL;
+    }
+    else if (growcars())
+        route = airport.cars + airport.ncars++;
+    else
+        return NULL;
+
+    i = route - airport.cars;
+    instance = route->instance_ref;
+    *route = *holder;
+    route->instance_ref = instance ? instance : XPLMCreateInstance(holder->object.objref, datarefs);
+    route->drawinfo = airport.cardrawinfo + i;
+    route->parent = holder;
+    route->next = NULL;
+    route->highway_car = car;
+    route->highway_offset = station;
+    route->last_node = 0;
+    route->next_y = INVALID_ALT;	/* Not drawn anywhere yet */
+    route->posed = 0;
+    route->posed_at = 0;
+    route->ready = -1;
+    highway->drawn[car/8] |= 1 << (car%8);
+    return route;
+}
 
-        /* Calculate drawing position */
-        last_node = route->path + route->last_node;
-        next_node = route->path + route->next_node;
 
-        if (route->next_y == INVALID_ALT)
-        {
-            /* Just loaded, or OpenGL projection has shifted while we are active */
-            route->next_y = last_node->p.y;	/* Unfortunately this will cause the object to fall off any bridge */
-            route->next_probe = route_now;	/* Force probe ahead */
-        }
+/* Double the size of the pool of routes for highway cars, and of the per-route arrays used by the pose phase.
+ * Returns 0 if out of memory */
+static int growcars(void)
+{
+    int maxcars = airport.maxcars ? airport.maxcars * 2 : HIGHWAY_POOL;
+    route_t *cars;
+    XPLMDrawInfo_t *cardrawinfo;
+    turn_t *turns;
+    bez4_t *beziers;
+    int i;
+
+    if (!(cars = realloc(airport.cars, maxcars * sizeof(route_t))))
+        return xplog("Out of memory!");
+    airport.cars = cars;
+    if (!(cardrawinfo = realloc(airport.cardrawinfo, maxcars * sizeof(XPLMDrawInfo_t))))
+        return xplog("Out of memory!");
+    airport.cardrawinfo = cardrawinfo;
+    for (i=0; i < airport.maxcars; i++)
+        cars[i].drawinfo = cardrawinfo + i;	/* May have moved */
+    if (!(turns = realloc(airport.turns, (airport.nroutes + maxcars) * sizeof(turn_t))))
+        return xplog("Out of memory!");
+    airport.turns = turns;
+    if (!(beziers = realloc(airport.beziers, (airport.nroutes + maxcars + 3) / 4 * sizeof(bez4_t))))
+        return xplog("Out of memory!");
+    airport.beziers = beziers;
+
+    memset(cars + airport.maxcars, 0, (maxcars - airport.maxcars) * sizeof(route_t));
+    memset(cardrawinfo + airport.maxcars, 0, (maxcars - airport.maxcars) * sizeof(XPLMDrawInfo_t));
+    for (i = airport.maxcars; i < maxcars; i++)
+    {
+        cardrawinfo[i].structSize = sizeof(XPLMDrawInfo_t);
+        cars[i].drawinfo = cardrawinfo + i;
+    }
+    airport.maxcars = maxcars;
+    return -1;
+}
 
-        if (!(route->state.paused||route->state.waiting||route->state.dataref||route->state.collision))
-        {
-            float probe_interval;
 
-            if (route->state.backingup && route->state.forwardsa && !last_node->flags.backup && route_now-route->last_time >= TURN_TIME/2)	/* C */
+/* Give a car's route back to the pool, keeping its instance for re-use */
+static void freecar(route_t *route)
+{
+    highway_t *highway = route->highway;
+
+    highway->drawn[route->highway_car/8] &= ~(1 << (route->highway_car%8));
+    route->ready = 0;
+    route->posed = 0;
+}
+
+
+/* Move an instance out of sight until it's destroyed or re-used. Doesn't need to know where it was drawn */
+void parkinstance(XPLMInstanceRef instance_ref)
+{
+    static const float dataref_values[dataref_count] = { 0 };
+    static const XPLMDrawInfo_t hidden = { sizeof(XPLMDrawInfo_t), 0, -HIDE_DEPTH, 0, 0, 0, 0 };
+
+    XPLMInstanceSetPosition(instance_ref, &hidden, dataref_values);
+}
+
+
+/* Give a car's route back to the pool, parking its instance out of sight until it's re-used */
+static void parkcar(route_t *route)
+{
+    if (route->instance_ref)
+        parkinstance(route->instance_ref);
+    freecar(route);
+}
+
+
+/* Give all cars' routes back to the pool. Called on deactivation */
+void parkcars(void)
+{
+    int i;
+
+    for (i=0; i < airport.ncars; i++)
+        if (airport.cars[i].ready)
+            parkcar(airport.cars + i);
+}
+
+
+/* Destroy the pool's instances of an object that's about to be unloaded, or all of them if objref is NULL */
+void dropcars(XPLMObjectRef objref)
+{
+    int i;
+
+    for (i=0; i < airport.ncars; i++)
+    {
+        route_t *route = airport.cars + i;
+        if (route->instance_ref && (!objref || route->object.objref == objref))
+        {
+            if (route->ready)
+                freecar(route);
+            XPLMDestroyInstance(route->instance_ref);
+            route->instance_ref = NULL;
+            route->object.objref = 0;
+        }
+    }
+}
+
+
+/* Update the highway cars that have routes from the pool, giving back those that have gone out of range */
+static void updatecars(float now, XPLMProbeInfo_t *probeinfo)
+{
+    int i;
+
+    for (i=0; i < airport.ncars; i++)
+    {
+        route_t *route = airport.cars + i;
+
+        if (!route->ready)
+            continue;
+        else if (!route->parent->ready || !flowcar(route, now))
+            parkcar(route);
+        else
+            trackroute(route, now, now, -1, probeinfo);
+    }
+}
+
+
+/* The route has reached its next waypoint, or the end of a pause or poll interval - work out what it does next.
+ * Only called for routes whose next_time has come, so kept out of the per-frame loop in drawcallback().
+ * tod and dow are looked up on first use and shared by all routes in this frame.
+ * Returns the time that the route is drawn at, which is reset if there's been a long gap in draw callbacks. */
+static float nextevent(route_t *route, float now, float route_now, int *tod, unsigned int *dow)
+{
+    path_t *last_node;
+    setcmd_t *setcmd = NULL;
+
+    if (route->state.waiting)
+    {
+        /* We don't get notified when time-of-day changes in the sim, so poll once a minute */
+        int i;
+        if (!*dow)
+        {
+            /* Get current day-of-week. FIXME: This is in user's timezone, not the airport's. */
+            struct tm tm = { 0, 0, 12, XPLMGetDatai(ref_doy)+1, 0, year };
+            *dow = (mktime(&tm) == -1) ? DAY_SUN : 1 << tm.tm_wday;
+        }
+        if (*tod < 0) *tod = (int) (XPLMGetDataf(ref_tod)/60);
+        for (i=0; i<MAX_ATTIMES; i++)
+        {
+            if (route->path[route->last_node].attime[i] == INVALID_AT)
+                break;
+            else if ((route->path[route->last_node].attime[i] == *tod) &&
+                     (route->path[route->last_node].atdays & *dow))
             {
-                /* Reached mirror of p3. Fixup things so we're backwards in time on otherwise normal path */
-                route->state.backingup = 0;
-                route->last_time += TURN_TIME;
-                route->next_distance -= route->speed * TURN_TIME;
+                route->state.waiting = 0;
+                route->state.collision = iscollision(route);	/* Re-check for collision */
+                break;
+            }
+        }
+        /* last and next were calculated when we originally hit this waypoint */
+    }
+    else if (route->state.dataref)
+    {
+        whenref_t *whenref = route->path[route->last_node].whenrefs;
+
+        while (whenref)
+        {
+            float val;
+            extref_t *extref = whenref->extref;
+
+            if (extref->type == xplmType_Mine)
+            {
+                val = userrefcallback(extref->ref);
             }
-            if (route->state.forwardsb && !route->state.backingup && route->last_time - route_now <= TURN_TIME/2)	/* Z */
+            else if (whenref->idx < 0)
             {
-                /* Reached mirror of p1. */
+                /* Not an array */
+                if (extref->type & xplmType_Float)
+                    val = XPLMGetDataf(extref->ref);
+                else if (extref->type & xplmType_Double)
+                    val = XPLMGetDatad(extref->ref);
+                else if (extref->type & xplmType_Int)
+                    val = XPLMGetDatai(extref->ref);
+                else
+                    val = 0;	/* Lookup failed or otherwise unusable */
+            }
+            else if (extref->type & xplmType_FloatArray)
+            {
+                XPLMGetDatavf(extref->ref, &val, whenref->idx, 1);
+            }
+            else if (extref->type & xplmType_IntArray)
+            {
+                int ival;
+                XPLMGetDatavi(extref->ref, &ival, whenref->idx, 1);
+                val = ival;
+            }
+            else
+            {
+                val = 0;	/* Lookup failed or otherwise unusable */
+            }
+
+            if ((val >= whenref->from) && (val <= whenref->to))
+                whenref = whenref->next;
+            else
+                break;		/* fail */
+        }
+
+        if (!whenref)
+        {
+            /* All passed */
+            route->state.dataref = 0;
+            route->state.collision = iscollision(route);	/* Re-check for collision */
+            /* last and next were calculated when we originally hit this waypoint */
+        }
+    }
+    else if (route->state.paused)
+    {
+        route->state.paused = 0;
+        route->state.collision = iscollision(route);	/* Re-check for collision */
+        /* last and next were calculated when we originally hit this waypoint */
+    }
+    else if (route->state.collision)
+    {
+        route->state.collision = iscollision(route);
+        /* last and next were calculated when we originally hit this waypoint */
+    }
+    else	/* next waypoint */
+    {
+#ifdef DO_BENCHMARK
+        if (route == airport.firstroute)
+        {
+            drawcumul = 0;
+            drawframes= XPLMGetDatai(ref_rentype) ? 0 : 1;
+        }
+#endif
+        route->last_odometer = route->nreserved ? route->last_odometer + route->next_distance : 0;	/* Only needed while holding conflict zones */
+        route->odometer = route->last_odometer;
+        route->last_node = route->next_node;
+        route->next_node += route->direction;
+        if (!route->last_node)
+            route->last_distance = 0;	/* reset distance travelled to prevent growing stupidly large */
+        else if (route->state.backingup)
+            route->last_distance -= route->next_distance;
+        else
+            route->last_distance += route->next_distance;
+        route->distance = route->last_distance;
+
+        if (route->path[route->last_node].flags.reverse)
+        {
+            route->direction = -1;
+            route->next_node = route->pathlen-2;
+        }
+        else if (route->next_node >= route->pathlen)
+        {
+            route->next_node = 0;	/* At end of route - head on to start */
+        }
+        else if (route->next_node < 0)
+        {
+            /* Back at start of route - start again */
+            route->direction = 1;
+            route->next_node = 1;
+        }
+        last_node = route->path + route->last_node;
+
+        route->last_heading = route->next_heading;
+        setsegment(route);
+
+        if (last_node->whenrefs)
+            route->state.dataref = 1;
+        if (last_node->attime[0] != INVALID_AT)
+            route->state.waiting = 1;
+        if (last_node->pausetime)
+            route->state.paused = 1;
+        setcmd = last_node->setcmds;
+        if (last_node->flags.backup)
+        {
+            if (last_node->pausetime)	/* A */
+            {
+                /* Backing up after pause */
                 route->state.backingup = 1;
+                route->state.forwardsa = 1;
+            }
+            else						/* Y */
+            {
+                /* Backing up before pause */
+                route->state.forwardsb = 1;
             }
-            else if (!(route->state.forwardsb || route->state.forwardsa) && now < route->last_time)
+        }
+        else
+        {
+            if (!route->state.forwardsa)			/* !Q */
             {
-                /* We must be in replay, and we've gone back in time beyond the last decision. Just show at the last node. */
-                route_now = route->last_time - route->object.lag;	/* Train objects are drawn in the past */
+                route->state.backingup = 0;
+                route->state.forwardsb = 0;
             }
+            if (!route->state.backingup && !route->state.forwardsb)	/* !B */
+            {
+                route->state.forwardsa = 0;
+            }
+        }
+        route->state.collision = iscollision(route);
+    }
+
+    last_node = route->path + route->last_node;
+
+    /* Maintain speed/progress unless there's been a large gap in draw callbacks because we were deactivated / disabled */
+    if (route->last_time && route_now - route->next_time < RESET_TIME)
+        route->last_time = route->next_time;
+    else
+    {
+        route->last_time = now;			/* reset */
+        route_now = route->last_time - route->object.lag;
+    }
+
+    if (route->state.waiting)
+        route->next_time = route->last_time + AT_INTERVAL;
+    else if (route->state.dataref)
+        route->next_time = route->last_time + WHEN_INTERVAL;
+    else if (route->state.paused)
+        route->next_time = route->last_time + last_node->pausetime;
+    else if (route->state.collision == (collision_t*) -1)
+        route->next_time = route->last_time + COLLISION_INTERVAL;	/* Poll for plane to get out of the way, or for collisions to be calculated */
+    else if (route->state.collision)
+        route->next_time = FLT_MAX;	/* Until the route we're waiting for releases the conflict zone or loads */
+    else if (route->state.forwardsa && !last_node->flags.backup)			/* B */
+    {
+        route->next_distance += route->speed * TURN_TIME;	/* Allow for extra turning distance */
+        route->next_time = route->last_time + route->next_distance / route->speed;
+    }
+    else if (route->state.forwardsb && last_node->flags.backup)	/* Y */
+    {
+        route->last_time += TURN_TIME;	/* Allow for extra turning distance */
+        route->next_time = route->last_time + route->next_distance / route->speed;
+    }
+    else
+        route->next_time = route->last_time + route->next_distance / route->speed;
+
+    /* Set DataRefs. Need to do this after calculating last_time so use hacky flag */
+    setdatarefs(setcmd, route->last_time, last_node->pausetime);
+
+    /* Keep our timeline in step with when we actually set off, e.g. after waiting for other routes */
+    if (route->timeline && (route->state.paused || !route->state.collision))
+    {
+        const leg_t *leg = route->timeline + route_leg(route);
+        route->timeline_start = route->last_time - (route->state.paused ? leg->arrive : leg->depart);
+    }
+
+    /* Force re-probe since we've changed direction */
+    route->next_probe = route_now;
+
+    return route_now;
+}
+
+
+/* Start the DataRef animations of a waypoint's set commands, on arrival at time start */
+static void setdatarefs(const setcmd_t *setcmd, float start, int pausetime)
+{
+    for (; setcmd; setcmd = setcmd->next)
+    {
+        userref_t *userref = setcmd->userref;
+
+        userref->duration = setcmd->duration;
+        userref->slope = setcmd->flags.slope;
+        userref->curve = setcmd->flags.curve;
+        if (setcmd->flags.set2)
+        {
+            userref->start1 = start;
+            userref->start2 = start + pausetime - userref->duration;
+        }
+        else if (setcmd->flags.set1)
+        {
+            userref->start1 = start;
+            userref->start2 = 0;
+        }
+    }
+}
+
+
+/* Time has jumped - we're in replay, or time is accelerated, or we haven't been simulated for a while.
+ * Move the route to where it would be at route_now if it had kept to its timeline since it last set off, i.e. without
+ * having had to wait for other routes. O(log n) in the number of waypoints. Our train's cars line up behind us again. */
+static void seekroute(route_t *route, float route_now)
+{
+    const leg_t *timeline = route->timeline;
+    float cycle = timeline[route->nlegs].arrive;
+    float t = fmodf(route_now - route->timeline_start, cycle);	/* Time into the current cycle */
+    int lo = 0, hi = route->nlegs;
+    path_t *last_node;
+
+    if (t < 0) t += cycle;	/* Before timeline_start in replay */
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if (timeline[mid].arrive <= t)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    route->timeline_start = route_now - t;
+
+    /* Stop waiting for or blocking other routes. We'll reserve the conflict zones we're in when we next set off */
+    unwait(route);
+    route->state.collision = NULL;
+    route->deadlocked = 0;
+    release_zones(route, -1);
+    route->last_odometer = route->odometer = 0;
+
+    route->last_node = leg_node(route, lo, &route->direction);
+    route->next_node = route->direction > 0 ? (route->last_node + 1) % route->pathlen : route->last_node - 1;
+    last_node = route->path + route->last_node;
+    route->last_distance = route->distance = timeline[lo].distance;
+    setsegment(route);
+    route->last_heading = route->next_heading;
+
+    if (t < timeline[lo].depart)
+    {
+        route->state.paused = 1;
+        route->last_time = route->timeline_start + timeline[lo].arrive;
+        route->next_time = route->timeline_start + timeline[lo].depart;
+    }
+    else
+    {
+        route->state.paused = 0;
+        route->last_time = route->timeline_start + timeline[lo].depart;
+        route->next_time = route->last_time + route->next_distance / route->speed;
+    }
+    setdatarefs(last_node->setcmds, route->timeline_start + timeline[lo].arrive, last_node->pausetime);
+
+    route->next_y = INVALID_ALT;	/* Discontinuity so reset */
+}
+
+
+/* Main update and draw loop */
+int drawcallback()                                                           // nst0022 2.2
+{
+    double airport_x, airport_y, airport_z;
+    float now, view_x, view_z;
+    route_t *route;
+    int tod=-1;
+    unsigned int dow=0;
+    XPLMProbeInfo_t probeinfo;
+#ifdef DO_BENCHMARK
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);		/* start */
+#endif
+
+    assert (airport.state == active || airport.state == activating);
+
+    XPLMWorldToLocal(airport.tower.lat, airport.tower.lon, airport.tower.alt, &airport_x, &airport_y, &airport_z);
+    if (airport.p.x != airport_x || airport.p.y != airport_y || airport.p.z != airport_z)
+    {
+        /* OpenGL projection has shifted */
+        airport.p.x=airport_x;  airport.p.y=airport_y;  airport.p.z=airport_z;
+        maproutes(&airport);
+    }
+
+    // nst0022 2.1  The following 'if' only works with xplm_Phase_Modern3D, for all other it needs to be commented out,
+    //              otherwise lod_factor gets not set, so there would be no objects drawn at all
+    //              Unclear, why this is necessary in the first place (3D rendering type: 0 = normal, 1 = reflections in water)
+    //if (!XPLMGetDatai(ref_rentype))
+    {
+        int width;
+        XPLMGetScreenSize(&width, NULL);
+        lod_factor = (float) width / lod_bias;	/* Screen size can change while paused, so need to recalculate once per frame */
+#ifdef DO_BENCHMARK
+        drawframes += 1;
+#endif
+
+        /* draw route paths */
+        if (airport.drawroutes)
+        {
+#if 0  /// HT
+#ifdef DEBUG
+            int planeno;
+#endif
+            GLint view[4] = { 0 };
+
+            XPLMSetGraphicsState(0, 0, 0,   0, 1,   0, 0);
+            glLineWidth(1.5);
+
+            XPLMGetScreenSize(view+2, view+3);	/* Real viewport reported by GL_VIEWPORT will be larger than physical screen if FSAA enabled */
+            drawdebug3d(-1, view);
+
+#ifdef DEBUG
+            /* Draw AI plane positions */
+            glColor4f(0,0,0,0.25f);
+            glBegin(GL_QUADS);
+            for (planeno=0; planeno<count_planes(); planeno++)
+            {
+                point_t *p;
+                int i;
+
+                if ((p = get_plane_footprint(planeno, 5.f, NULL, NULL)))	/* Display 5 seconds ahead */
+                    for (i=0; i<4; i++)
+                        glVertex3fv(&(p[i].x));
+            }
+            glEnd();
+#endif
+#endif /// HT
+        }
+    }
+
+    /* We can be called multiple times per frame depending on shadow settings -
+     * ("sim/graphics/view/world_render_type" = 0 if normal draw, 3 if shadow draw (which precedes normal))
+     * So skip calculations and just draw if we've already run the calculations for this frame. */
+    if ((now = XPLMGetDataf(ref_monotonic)) == last_frame)
+    {
+        drawroutes();
+#ifdef DO_BENCHMARK
+        gettimeofday(&t2, NULL);		/* stop */
+        drawcumul += (t2.tv_sec-t1.tv_sec) * 1000000 + t2.tv_usec - t1.tv_usec;
+#endif
+#ifdef DEBUG
+        if (!XPLMGetDatai(ref_rentype)) last_frame = 0;	/* In DEBUG recalculate positions once per frame for easier debugging */
+#endif
+        return 1;
+    }
+    last_frame = now;
+
+    /* Update and draw, in three phases:
+     * 1. Update each route's state. Done in the main thread, since it calls XPLM and routes interact through trains,
+     *    collisions and waiters. In list order, so that trains' children follow their parents.
+     * 2. Calculate where to draw each route. Pure arithmetic on each route's own state, so shared out among threads.
+     * 3. Publish the positions to X-Plane in drawroutes(). */
+    is_night = (int) (XPLMGetDataf(ref_night) + 0.67f);
+    probeinfo.structSize = sizeof(XPLMProbeInfo_t);
+    view_x = XPLMGetDataf(ref_view_x);
+    view_z = XPLMGetDataf(ref_view_z);
+    tierframe++;
+
+    for(route=airport.routes; route; route=route->next)
+    {
+        float route_now = now - route->object.lag;	/* Train objects are drawn in the past */
 
+        if (route->highway)
+        {
+            /* Highways' routes just hold their objects. Their cars are drawn from the pool - see flowhighway() */
+            if (!route->parent)
+                flowhighway(route, now, view_x, view_z);
+            continue;
+        }
+
+        if (!route->ready)
+            continue;	/* Don't simulate routes that are still loading or in cells that are out of range */
+        else if (route->parent)
+            continue;	/* Trains' cars just follow their heads - see followtrail() */
+
+        if ((route_now - route->next_time >= RESET_TIME || now < route->last_time) && route->timeline && route->last_time)
+            seekroute(route, route_now);	/* Time has jumped */
+
+        /* Only 1-2% of routes are due in any one frame, but we don't keep them in a queue ordered by next_time since
+         * trackroute() has to visit every route anyway, and list order decides which route gets a conflict zone first */
+        if (route_now >= route->next_time)
+            route_now = nextevent(route, now, route_now, &tod, &dow);
+
+        /* Calculate drawing position */
+        trackroute(route, now, route_now, needpose(route, now, view_x, view_z, tierframe), &probeinfo);
+    }
+    updatecars(now, &probeinfo);
+
+    /* Calculate drawing positions. Then trains' cars follow the trails that their heads have just recorded */
+    posepass(0, airport.nroutes + airport.ncars, 0);
+    if (airport.nleaders < airport.nroutes)
+        posepass(airport.nleaders & ~3, airport.nroutes, -1);	/* Chunks must start on a multiple of 4 for bez4() */
+
+    drawroutes();
+
+#ifdef DO_BENCHMARK
+    gettimeofday(&t2, NULL);		/* stop */
+    drawcumul += (t2.tv_sec-t1.tv_sec) * 1000000 + t2.tv_usec - t1.tv_usec;
+#endif
+    return 1;
+}
+
+
+/* Work out how far the route is along its path segment, and its altitude, and save them for the pose phase.
+ * posed is whether the pose phase needs to work out where to draw it, as returned by needpose(). */
+static void trackroute(route_t *route, float now, float route_now, int posed, XPLMProbeInfo_t *probeinfo)
+{
+    path_t *last_node = route->path + route->last_node;
+    path_t *next_node = route->path + route->next_node;
+    float progress;
+
+    if (route->next_y == INVALID_ALT)
+    {
+        /* Just loaded, or OpenGL projection has shifted while we are active */
+        route->next_y = last_node->p.y;	/* Unfortunately this will cause the object to fall off any bridge */
+        route->next_probe = route_now;	/* Force probe ahead */
+        route->trailcount = 0;		/* Our train's cars can't follow us across the discontinuity */
+    }
+
+    if (!route->nreserved && airport.done_collisions && !route->parent && !route->highway &&
+        !(route->state.paused||route->state.waiting||route->state.dataref||route->state.collision) &&
+        (route->state.collision = iscollision(route)))
+    {
+        /* Just activated or come into range, and someone else is in the conflict zones that we're in. We can't stop
+         * part way along a path segment, so wait for them at our last waypoint like any other route */
+        route->last_time = now;
+        route->next_time = route->state.collision == (collision_t*) -1 ? now + COLLISION_INTERVAL : FLT_MAX;
+        route->odometer = route->last_odometer;
+    }
+
+    if (!(route->state.paused||route->state.waiting||route->state.dataref||route->state.collision))
+    {
+        float probe_interval;
+
+        if (route->state.backingup && route->state.forwardsa && !last_node->flags.backup && route_now-route->last_time >= TURN_TIME/2)	/* C */
+        {
+            /* Reached mirror of p3. Fixup things so we're backwards in time on otherwise normal path */
+            route->state.backingup = 0;
+            route->last_time += TURN_TIME;
+            route->next_distance -= route->speed * TURN_TIME;
+        }
+        if (route->state.forwardsb && !route->state.backingup && route->last_time - route_now <= TURN_TIME/2)	/* Z */
+        {
+            /* Reached mirror of p1. */
+            route->state.backingup = 1;
+        }
+        else if (!(route->state.forwardsb || route->state.forwardsa) && now < route->last_time)
+        {
+            /* We must be in replay, and we've gone back in time beyond the last decision. Just show at the last node. */
+            route_now = route->last_time - route->object.lag;	/* Train objects are drawn in the past */
+        }
+
+        progress = (route_now - route->last_time) / (route->next_time - route->last_time);
+        if (posed)
+        {
+            if (!route->posed && now - route->posed_at > PROBE_INTERVAL)
+            {
+                /* Back in range after a while so our probes are stale - start again from the waypoints' altitudes */
+                route->next_y = last_node->p.y + fminf(fmaxf(progress, 0), 1) * (next_node->p.y - last_node->p.y);
+                route->next_probe = route_now;
+                route->trailcount = 0;	/* Likewise our trail */
+            }
             if (route_now >= route->next_probe)
             {
                 /* Probe up to PROBE_INTERVAL into the future */
@@ -590,190 +1202,320 @@ int drawcallback()                                                           //
                 {
                     route->next_probe = route->next_time;
                     probe_interval = route->next_probe - route->last_probe;
-                    XPLMProbeTerrainXYZ(ref_probe, next_node->p.x, route->last_y + route->speed * probe_interval * PROBE_GRADIENT, next_node->p.z, &probeinfo);
+                    XPLMProbeTerrainXYZ(ref_probe, next_node->p.x, route->last_y + route->speed * probe_interval * PROBE_GRADIENT, next_node->p.z, probeinfo);
                 }
                 else
                 {
+                    float ahead = (route_now + PROBE_INTERVAL - route->last_time) / (route->next_time - route->last_time);
                     route->next_probe = route_now + PROBE_INTERVAL;
                     probe_interval = route->next_probe - route->last_probe;
-                    progress = (route->next_probe - route->last_time) / (route->next_time - route->last_time);
-                    XPLMProbeTerrainXYZ(ref_probe, last_node->p.x + progress * (next_node->p.x - last_node->p.x), route->last_y + route->speed * PROBE_INTERVAL * PROBE_GRADIENT, last_node->p.z + progress * (next_node->p.z - last_node->p.z), &probeinfo);
+                    XPLMProbeTerrainXYZ(ref_probe, last_node->p.x + ahead * (next_node->p.x - last_node->p.x), route->last_y + route->speed * PROBE_INTERVAL * PROBE_GRADIENT, last_node->p.z + ahead * (next_node->p.z - last_node->p.z), probeinfo);
                 }
-                route->next_y = probeinfo.locationY;
+                route->next_y = probeinfo->locationY;
             }
             else
             {
                 probe_interval = route->next_probe - route->last_probe;
             }
 
-            progress = (route_now - route->last_time) / (route->next_time - route->last_time);
             route->drawinfo->y = route->next_y + (route->last_y - route->next_y) * (route->next_probe - route_now) / probe_interval;
             if (!route->object.heading)
                 route->drawinfo->pitch = R2D(sinf((route->next_y - route->last_y) / (probe_interval * route->speed)));
             else if (route->object.heading == 180)
                 route->drawinfo->pitch = R2D(sinf((route->last_y - route->next_y) / (probe_interval * route->speed)));
-            if (route->state.backingup)
-                route->distance = route->last_distance - progress * route->next_distance;
-            else
-                route->distance = route->last_distance + progress * route->next_distance;
-            route->steer = 0;
         }
+        if (route->state.backingup)
+            route->distance = route->last_distance - progress * route->next_distance;
         else
+            route->distance = route->last_distance + progress * route->next_distance;
+        route->steer = 0;
+
+        if (!route->parent && !route->highway)
         {
-            /* Paused: Fake up times for drawing code below */
-            progress = - (route->object.lag * route->speed) / route->next_distance;
-            route_now = route->last_time - route->object.lag;
-            route->drawinfo->y = route->next_y;
-            route->drawinfo->pitch = 0;	/* Since we're not probing */
+            route->odometer = route->last_odometer + fminf(fmaxf(progress, 0), 1) * route->next_distance;
+            if (route->odometer >= route->release_at)
+                release_zones(route, 0);
         }
+    }
+    else
+    {
+        /* Paused: Fake up times for drawing code below */
+        progress = - (route->object.lag * route->speed) / route->next_distance;
+        route_now = route->last_time - route->object.lag;
+        route->drawinfo->y = route->next_y;
+        route->drawinfo->pitch = 0;	/* Since we're not probing */
+    }
 
 #ifdef DO_MARKERS
-        {
-            /* Show markers - which are only visible if shadows turned off! */
-            path_t *node = progress < 0.5f ? last_node : next_node;
-            XPLMSetGraphicsState(0, 0, 0,   0, 0,   0, 0);
-            glLineWidth(3);
-            glColor3f(1,0,0);
-            glBegin(GL_LINE_STRIP);
-            glVertex3f(node->p1.x, node->p.y,    node->p1.z);
-            glVertex3f(node->p1.x, node->p.y+10, node->p1.z);
-            glEnd();
-            glColor3f(0,1,0);
-            glBegin(GL_LINE_STRIP);
-            glVertex3f(node->p.x,  node->p.y,    node->p.z);
-            glVertex3f(node->p.x,  node->p.y+10, node->p.z);
-            glEnd();
-            glColor3f(0,0,1);
-            glBegin(GL_LINE_STRIP);
-            glVertex3f(node->p3.x, node->p.y,    node->p3.z);
-            glVertex3f(node->p3.x, node->p.y+10, node->p3.z);
-            glEnd();
-        }
+    {
+        /* Show markers - which are only visible if shadows turned off! */
+        path_t *node = progress < 0.5f ? last_node : next_node;
+        XPLMSetGraphicsState(0, 0, 0,   0, 0,   0, 0);
+        glLineWidth(3);
+        glColor3f(1,0,0);
+        glBegin(GL_LINE_STRIP);
+        glVertex3f(node->p1.x, node->p.y,    node->p1.z);
+        glVertex3f(node->p1.x, node->p.y+10, node->p1.z);
+        glEnd();
+        glColor3f(0,1,0);
+        glBegin(GL_LINE_STRIP);
+        glVertex3f(node->p.x,  node->p.y,    node->p.z);
+        glVertex3f(node->p.x,  node->p.y+10, node->p.z);
+        glEnd();
+        glColor3f(0,0,1);
+        glBegin(GL_LINE_STRIP);
+        glVertex3f(node->p3.x, node->p.y,    node->p3.z);
+        glVertex3f(node->p3.x, node->p.y+10, node->p3.z);
+        glEnd();
+    }
 #endif
 
-        /* Finally do the drawing */
-        if (route->state.backingup)
-        {
-            point_t pr;	/* Mirror of p1/p3 */
+    /* Save state for the pose phase */
+    if ((route->posed = posed))
+        route->posed_at = now;
+    route->pose_now = route_now;
+    route->pose_progress = progress;
+}
 
-            if (progress >= 0.5f)
-            {
-                /* Approaching a waypoint while backing up */
-                if (next_node->flags.backup || route->next_time - route_now >= TURN_TIME/2 || !(next_node->p1.x || next_node->p1.z))
-                {
-                    /* No bezier points, or not in range, or approaching backup node */
-                    route->drawinfo->x = last_node->p.x + progress * (next_node->p.x - last_node->p.x);
-                    route->drawinfo->z = last_node->p.z + progress * (next_node->p.z - last_node->p.z);
-                    route->drawinfo->heading = route->next_heading;
-                }
-                else
-                {
-                    assert(route->state.forwardsa);
-                    pr.x = next_node->p.x + next_node->p.x - next_node->p3.x;
-                    pr.z = next_node->p.z + next_node->p.z - next_node->p3.z;
-                    if (route->speed * 2 <= route->next_distance)
-                        bez(route->drawinfo, &next_node->p1, &next_node->p, &pr, 0.5f + (route_now - route->next_time)/TURN_TIME);
-                    else	/* Short edge */
-                        bez(route->drawinfo, &next_node->p1, &next_node->p, &pr, progress - 0.5f);
-                    route->steer = route->next_heading - route->drawinfo->heading;
-                }
-            }
-            else if (route->state.forwardsb && (route_now - route->last_time < TURN_TIME/2) && (last_node->p1.x || last_node->p1.z))
-            {
-                /* Leaving mirrored p1 waypoint while backing up */
-                pr.x = last_node->p.x + last_node->p.x - last_node->p1.x;
-                pr.z = last_node->p.z + last_node->p.z - last_node->p1.z;
-                if (progress <0 || route->speed * 2 <= route->next_distance)
-                    bez(route->drawinfo, &pr, &last_node->p, &last_node->p3, 0.5f + (route_now - route->last_time)/TURN_TIME);
-                else	/* Short edge */
-                    bez(route->drawinfo, &pr, &last_node->p, &last_node->p3, progress + 0.5f);
-                if (progress < 0)
-                    route->steer = 180 - route->drawinfo->heading + R2D(atan2f(pr.x - last_node->p.x, last_node->p.z - pr.z));	/* Don't have a route->last_heading */
-                else
-                    route->steer = route->drawinfo->heading - route->next_heading;
-            }
-            else if (route->state.forwardsa && (route_now - route->last_time < TURN_TIME/2) && (last_node->p3.x || last_node->p3.z))
-            {
-                /* Leaving a waypoint while backing up */
-                pr.x = last_node->p.x + last_node->p.x - last_node->p3.x;
-                pr.z = last_node->p.z + last_node->p.z - last_node->p3.z;
-                if (route->speed * 2 <= route->next_distance)
-                    bez(route->drawinfo, &last_node->p1, &last_node->p, &pr, 0.5f + (route_now - route->last_time)/TURN_TIME);
-                else	/* Short edge */
-                    bez(route->drawinfo, &last_node->p1, &last_node->p, &pr, progress + 0.5f);
-                route->steer = 180 - route->next_heading + route->drawinfo->heading;
-            }
-            else
-            {
-                route->drawinfo->x = last_node->p.x + progress * (next_node->p.x - last_node->p.x);
-                route->drawinfo->z = last_node->p.z + progress * (next_node->p.z - last_node->p.z);
-                route->drawinfo->heading = route->next_heading;
-            }
-            route->drawinfo->heading -= 180;
-            route->drawinfo->pitch = -route->drawinfo->pitch;
-        } /* (route->state.backingup) */
 
-        else if (route->state.forwardsb && (last_node->p1.x || last_node->p1.z))
+/* Whether to work out where to draw the route this frame, going by its distance from the view when we last did.
+ * Routes that might be within their draw distance are updated every frame, routes within TIER_SLOW times that every
+ * TIER_SLOW_FRAMES frames, and routes beyond that not at all. Since poseroute() only depends on the route's current
+ * state a route is drawn in exactly the same place when it comes back into range as if it had been updated throughout. */
+static inline int needpose(const route_t *route, float now, float view_x, float view_z, unsigned int frame)
+{
+    float x, z, dist2, range, slack;
+
+    if (!route->object.drawlod)
+        return -1;	/* LOD not calculated yet, so drawroutes() draws it regardless */
+    else if (route->next_y == INVALID_ALT)
+        return -1;	/* Just loaded or OpenGL projection has shifted, so last position is meaningless */
+
+    /* Can't have travelled further than this since we were last posed. fabsf() since time goes backwards in replay */
+    x = route->drawinfo->x - view_x;
+    z = route->drawinfo->z - view_z;
+    dist2 = x*x + z*z;
+    range = route->object.drawlod * lod_factor + route->trainlength;	/* Our train's cars are posed along with us */
+    slack = route->speed * fabsf(now - route->posed_at) + TIER_MARGIN;
+    if (dist2 <= (range + slack) * (range + slack))
+        return -1;
+    else if (dist2 <= (range * TIER_SLOW + slack) * (range * TIER_SLOW + slack))
+        return !((frame + (unsigned int) (route - airport.routetbl)) % TIER_SLOW_FRAMES);
+    else
+        return 0;
+}
+
+
+/* Altitude for collision checks. Routes that are out of range, or that we haven't drawn yet, aren't posed so go by their
+ * waypoints' altitudes */
+static inline float collision_y(const route_t *route, float progress)
+{
+    const path_t *last_node = route->path + route->last_node;
+    const path_t *next_node = route->path + route->next_node;
+
+    if (route->posed)
+        return route->drawinfo->y;	/* In range */
+    else
+        return last_node->p.y + fminf(fmaxf(progress, 0), 1) * (next_node->p.y - last_node->p.y);
+}
+
+
+/* Start pose worker threads if there are enough routes to keep them busy. Called on activation, after sortroutes() */
+int start_pose_workers(void)
+{
+    int n = airport.nroutes / POSE_ROUTES_PER_THREAD;
+
+    if (n > cpu_count()) n = cpu_count();
+    if (n > MAX_POSE_THREADS) n = MAX_POSE_THREADS;
+    if (n <= 1 || nposethreads) return -1;	/* Main thread works alone, or already started */
+
+    signal_init(&posesignal);
+    posenext = INT_MAX;
+    posebusy = 0;
+    for (nposethreads = 1; nposethreads < n; nposethreads++)
+        if (!worker_start(poseworkers + nposethreads, pose_task, poseworkers + nposethreads))
         {
-            /* Backing up to pause, keep going to mirror of p1 */
-            progress = 2 - (route->last_time - route_now) / (TURN_TIME/2);
-            route->drawinfo->x = last_node->p.x + progress * (last_node->p.x - last_node->p1.x);
-            route->drawinfo->z = last_node->p.z + progress * (last_node->p.z - last_node->p1.z);
-            route->drawinfo->heading -= route->object.heading;	/* Keep last heading */
+            stop_pose_workers();
+            return 0;
         }
-        else if (progress >= 0.5f)
+    return -1;
+}
+
+
+/* Signal pose worker threads and wait for them to stop */
+void stop_pose_workers(void)
+{
+    int i;
+
+    if (!nposethreads) return;
+    signal_lock(&posesignal);
+    for (i = 1; i < nposethreads; i++)
+        poseworkers[i].die_please = -1;
+    signal_broadcast(&posesignal);
+    signal_unlock(&posesignal);
+    for (i = 1; i < nposethreads; i++)
+        worker_wait(poseworkers + i);
+    signal_destroy(&posesignal);
+    nposethreads = 0;
+}
+
+
+/* Pose worker thread - sleeps until drawcallback() has routes to pose */
+static void *pose_task(void *arg)
+{
+    worker_t *worker = arg;
+
+    signal_lock(&posesignal);
+    while (!worker->die_please)
+    {
+        if (posenext < posecount)
+            posechunks();
+        else
+            signal_wait(&posesignal);
+    }
+    signal_unlock(&posesignal);
+    worker_has_finished(worker);
+    return NULL;
+}
+
+
+/* One pass of the pose phase over routes from index first up to last - in parallel if there are enough routes to make
+ * it worthwhile. All of the pass's routes are posed before returning. */
+static void posepass(int first, int last, int follow)
+{
+    if (nposethreads)
+    {
+        signal_lock(&posesignal);
+        posefollow = follow;
+        posecount = last;
+        posenext = first;
+        signal_broadcast(&posesignal);
+        posechunks();
+        while (posebusy)
+            signal_wait(&posesignal);
+        posenext = INT_MAX;	/* So that the workers don't see work if the next pass's range is larger */
+        signal_unlock(&posesignal);
+    }
+    else
+    {
+        posefollow = follow;
+        poseroutes(first, last);
+    }
+}
+
+
+/* Take chunks of routes and pose them until there are none left. Called with posesignal locked */
+static void posechunks(void)
+{
+    while (posenext < posecount)
+    {
+        int first = posenext;
+
+        posenext += POSE_CHUNK;
+        posebusy++;
+        signal_unlock(&posesignal);
+        poseroutes(first, first + POSE_CHUNK < posecount ? first + POSE_CHUNK : posecount);
+        signal_lock(&posesignal);
+        if (!--posebusy && posenext >= posecount)
+            signal_broadcast(&posesignal);	/* Wake drawcallback() */
+    }
+}
+
+
+/* Pose phase of drawcallback() - work out where to draw the ready routes from index first up to last.
+ * Indices from airport.nroutes onwards are the pool of highway cars.
+ * Doesn't call XPLM or touch any other route, so may be called from a pose worker thread. */
+static void poseroutes(int first, int last)
+{
+    turnqueue_t queue = { airport.turns + first, airport.beziers + first/4, 0 };	/* first is a multiple of 4 */
+    int i;
+
+    if (posefollow)
+    {
+        for (i = first; i < last; i++)
+            if (airport.routetbl[i].parent && airport.routetbl[i].ready && !airport.routetbl[i].highway)
+                followtrail(airport.routetbl + i);
+        return;
+    }
+    for (i = first; i < last; i++)
+    {
+        route_t *route;
+
+        if (i < airport.nleaders)
+            route = airport.routetbl + i;
+        else if (i < airport.nroutes)
+            continue;	/* Trains' cars follow in the second pass */
+        else
+            route = airport.cars + (i - airport.nroutes);
+        if (route->ready && route->posed)
+            poseroute(route, &queue);
+    }
+    flushturns(&queue);
+}
+
+
+/* Work out where to draw the route, using the time and progress saved by drawcallback() */
+static inline void poseroute(route_t *route, turnqueue_t *queue)
+{
+    path_t *last_node = route->path + route->last_node;
+    path_t *next_node = route->path + route->next_node;
+    float route_now = route->pose_now;
+    float progress = route->pose_progress;
+    float dx = route->next_dx, dz = route->next_dz;	/* Unit vector along drawinfo->heading */
+    float mu;
+    int nturns = queue->nturns;
+
+    /* Finally do the drawing */
+    if (route->state.backingup)
+    {
+        point_t pr;	/* Mirror of p1/p3 */
+
+        if (progress >= 0.5f)
         {
-            /* Approaching a waypoint */
-            if (next_node->flags.backup || (route->next_time - route_now >= TURN_TIME/2) || !(next_node->p1.x || next_node->p1.z))
+            /* Approaching a waypoint while backing up */
+            if (next_node->flags.backup || route->next_time - route_now >= TURN_TIME/2 || !(next_node->p1.x || next_node->p1.z))
             {
                 /* No bezier points, or not in range, or approaching backup node */
                 route->drawinfo->x = last_node->p.x + progress * (next_node->p.x - last_node->p.x);
                 route->drawinfo->z = last_node->p.z + progress * (next_node->p.z - last_node->p.z);
                 route->drawinfo->heading = route->next_heading;
             }
-            else if (route->direction > 0)
-            {
-                if (route->speed * 2 <= route->next_distance)
-                    bez(route->drawinfo, &next_node->p1, &next_node->p, &next_node->p3, 0.5f + (route_now - route->next_time)/TURN_TIME);
-                else	/* Short edge */
-                    bez(route->drawinfo, &next_node->p1, &next_node->p, &next_node->p3, progress - 0.5f);
-                route->steer = route->drawinfo->heading - route->next_heading;
-            }
             else
             {
+                assert(route->state.forwardsa);
+                pr.x = next_node->p.x + next_node->p.x - next_node->p3.x;
+                pr.z = next_node->p.z + next_node->p.z - next_node->p3.z;
                 if (route->speed * 2 <= route->next_distance)
-                    bez(route->drawinfo, &next_node->p3, &next_node->p, &next_node->p1, 0.5f + (route_now - route->next_time)/TURN_TIME);
+                    mu = 0.5f + (route_now - route->next_time)/TURN_TIME;
                 else	/* Short edge */
-                    bez(route->drawinfo, &next_node->p3, &next_node->p, &next_node->p1, progress - 0.5f);
-                route->steer = route->drawinfo->heading - route->next_heading;
+                    mu = progress - 0.5f;
+                queueturn(queue, route, &next_node->p1, &next_node->p, &pr, mu, -1, route->next_heading);
             }
         }
-        else if (route->state.forwardsa && progress<0 && (last_node->p3.x || last_node->p3.z))
+        else if (route->state.forwardsb && (route_now - route->last_time < TURN_TIME/2) && (last_node->p1.x || last_node->p1.z))
         {
-            /* Leaving mirror of p3. Special handling to deal with short paths. */
-            progress = (route->last_time - route_now) / (TURN_TIME/2);
-            route->drawinfo->x = last_node->p.x + progress * (last_node->p.x - last_node->p3.x);
-            route->drawinfo->z = last_node->p.z + progress * (last_node->p.z - last_node->p3.z);
-            route->drawinfo->heading = route->next_heading;
+            /* Leaving mirrored p1 waypoint while backing up */
+            pr.x = last_node->p.x + last_node->p.x - last_node->p1.x;
+            pr.z = last_node->p.z + last_node->p.z - last_node->p1.z;
+            if (progress <0 || route->speed * 2 <= route->next_distance)
+                mu = 0.5f + (route_now - route->last_time)/TURN_TIME;
+            else	/* Short edge */
+                mu = progress + 0.5f;
+            if (progress < 0)
+                queueturn(queue, route, &pr, &last_node->p, &last_node->p3, mu, -1, 180 + R2D(atan2f(pr.x - last_node->p.x, last_node->p.z - pr.z)));	/* Don't have a route->last_heading */
+            else
+                queueturn(queue, route, &pr, &last_node->p, &last_node->p3, mu, 1, -route->next_heading);
         }
-        else if (!route->state.forwardsa && (route_now - route->last_time < TURN_TIME/2) && (last_node->p3.x || last_node->p3.z))
+        else if (route->state.forwardsa && (route_now - route->last_time < TURN_TIME/2) && (last_node->p3.x || last_node->p3.z))
         {
-            /* Leaving a waypoint (may be from a negative direction if a paused child) */
-            if (route->direction > 0)
-            {
-                if ((progress < 0) || (route->speed * 2 <= route->next_distance))
-                    bez(route->drawinfo, &last_node->p1, &last_node->p, &last_node->p3, 0.5f + (route_now - route->last_time)/TURN_TIME);
-                else	/* Short edge */
-                    bez(route->drawinfo, &last_node->p1, &last_node->p, &last_node->p3, progress + 0.5f);
-            }
-            else
-            {
-                if ((progress < 0) || (route->speed * 2 <= route->next_distance))
-                    bez(route->drawinfo, &last_node->p3, &last_node->p, &last_node->p1, 0.5f + (route_now - route->last_time)/TURN_TIME);
-                else	/* Short edge */
-                    bez(route->drawinfo, &last_node->p3, &last_node->p, &last_node->p1, progress + 0.5f);
-            }
-            route->steer = route->next_heading - route->drawinfo->heading;
+            /* Leaving a waypoint while backing up */
+            pr.x = last_node->p.x + last_node->p.x - last_node->p3.x;
+            pr.z = last_node->p.z + last_node->p.z - last_node->p3.z;
+            if (route->speed * 2 <= route->next_distance)
+                mu = 0.5f + (route_now - route->last_time)/TURN_TIME;
+            else	/* Short edge */
+                mu = progress + 0.5f;
+            queueturn(queue, route, &last_node->p1, &last_node->p, &pr, mu, 1, 180 - route->next_heading);
         }
         else
         {
@@ -781,41 +1523,271 @@ int drawcallback()                                                           //
             route->drawinfo->z = last_node->p.z + progress * (next_node->p.z - last_node->p.z);
             route->drawinfo->heading = route->next_heading;
         }
-        if (route->object.offset)
+        if (queue->nturns == nturns)
+        {
+            route->drawinfo->heading -= 180;	/* Otherwise done once the turn is evaluated */
+            dx = -dx;
+            dz = -dz;
+        }
+        route->drawinfo->pitch = -route->drawinfo->pitch;
+    } /* (route->state.backingup) */
+
+    else if (route->state.forwardsb && (last_node->p1.x || last_node->p1.z))
+    {
+        /* Backing up to pause, keep going to mirror of p1 */
+        progress = 2 - (route->last_time - route_now) / (TURN_TIME/2);
+        route->drawinfo->x = last_node->p.x + progress * (last_node->p.x - last_node->p1.x);
+        route->drawinfo->z = last_node->p.z + progress * (last_node->p.z - last_node->p1.z);
+        route->drawinfo->heading = route->last_heading;
+        dx = sinf(D2R(route->last_heading));
+        dz = -cosf(D2R(route->last_heading));
+    }
+    else if (progress >= 0.5f)
+    {
+        /* Approaching a waypoint */
+        if (next_node->flags.backup || (route->next_time - route_now >= TURN_TIME/2) || !(next_node->p1.x || next_node->p1.z))
+        {
+            /* No bezier points, or not in range, or approaching backup node */
+            route->drawinfo->x = last_node->p.x + progress * (next_node->p.x - last_node->p.x);
+            route->drawinfo->z = last_node->p.z + progress * (next_node->p.z - last_node->p.z);
+            route->drawinfo->heading = route->next_heading;
+        }
+        else
         {
-            float h = D2R(route->drawinfo->heading);
-            route->drawinfo->x += sinf(h) * route->object.offset;
-            route->drawinfo->z -= cosf(h) * route->object.offset;
+            if (route->speed * 2 <= route->next_distance)
+                mu = 0.5f + (route_now - route->next_time)/TURN_TIME;
+            else	/* Short edge */
+                mu = progress - 0.5f;
+            if (route->direction > 0)
+                queueturn(queue, route, &next_node->p1, &next_node->p, &next_node->p3, mu, 1, -route->next_heading);
+            else
+                queueturn(queue, route, &next_node->p3, &next_node->p, &next_node->p1, mu, 1, -route->next_heading);
         }
-        if (route->steer)
-            route->steer = fmodf(route->steer + 540, 360) - 180;	/* to range -180..180 */
-        route->drawinfo->heading += route->object.heading;
     }
+    else if (route->state.forwardsa && progress<0 && (last_node->p3.x || last_node->p3.z))
+    {
+        /* Leaving mirror of p3. Special handling to deal with short paths. */
+        progress = (route->last_time - route_now) / (TURN_TIME/2);
+        route->drawinfo->x = last_node->p.x + progress * (last_node->p.x - last_node->p3.x);
+        route->drawinfo->z = last_node->p.z + progress * (last_node->p.z - last_node->p3.z);
+        route->drawinfo->heading = route->next_heading;
+    }
+    else if (!route->state.forwardsa && (route_now - route->last_time < TURN_TIME/2) && (last_node->p3.x || last_node->p3.z))
+    {
+        /* Leaving a waypoint (may be from a negative direction if a paused child) */
+        if ((progress < 0) || (route->speed * 2 <= route->next_distance))
+            mu = 0.5f + (route_now - route->last_time)/TURN_TIME;
+        else	/* Short edge */
+            mu = progress + 0.5f;
+        if (route->direction > 0)
+            queueturn(queue, route, &last_node->p1, &last_node->p, &last_node->p3, mu, -1, route->next_heading);
+        else
+            queueturn(queue, route, &last_node->p3, &last_node->p, &last_node->p1, mu, -1, route->next_heading);
+    }
+    else
+    {
+        route->drawinfo->x = last_node->p.x + progress * (next_node->p.x - last_node->p.x);
+        route->drawinfo->z = last_node->p.z + progress * (next_node->p.z - last_node->p.z);
+        route->drawinfo->heading = route->next_heading;
+    }
+    if (queue->nturns == nturns)
+        finishpose(route, dx, dz);
+}
 
-    drawroutes();
 
-#ifdef DO_BENCHMARK
-    gettimeofday(&t2, NULL);		/* stop */
-    drawcumul += (t2.tv_sec-t1.tv_sec) * 1000000 + t2.tv_usec - t1.tv_usec;
-#endif
-    return 1;
+/* Queue a turn along the quadratic Bezier curve p1->p2->p3 for flushturns() to evaluate along with the others */
+static inline void queueturn(turnqueue_t *queue, route_t *route, const point_t *p1, const point_t *p2, const point_t *p3, float mu, float steer_sign, float steer_base)
+{
+    turn_t *turn = queue->turns + queue->nturns;
+    bez4_t *b = queue->beziers + queue->nturns / 4;
+    int i = queue->nturns++ % 4;
+
+    // assert (mu>=0 && mu<=1);	// Trains may go negative at start or in replay
+    turn->route = route;
+    turn->steer_sign = steer_sign;
+    turn->steer_base = steer_base;
+    b->p1x[i] = p1->x;  b->p1z[i] = p1->z;
+    b->p2x[i] = p2->x;  b->p2z[i] = p2->z;
+    b->p3x[i] = p3->x;  b->p3z[i] = p3->z;
+    b->mu[i] = mu;
 }
 
 
-static void bez(XPLMDrawInfo_t *drawinfo, point_t *p1, point_t *p2, point_t *p3, float mu)
+/* Evaluate the queued turns four at a time, and finish off those routes' poses */
+static void flushturns(turnqueue_t *queue)
 {
-    float mum1, mum12, mu2;
-    float tx, tz;
+    int i;
+
+    /* Pad out the last batch with something harmless */
+    for (i = queue->nturns; i % 4; i++)
+    {
+        bez4_t *b = queue->beziers + i / 4;
+        b->p1x[i%4] = b->p1z[i%4] = b->p2x[i%4] = b->p2z[i%4] = b->p3x[i%4] = b->p3z[i%4] = b->mu[i%4] = 0;
+    }
+
+    for (i = 0; i < queue->nturns; i++)
+    {
+        turn_t *turn = queue->turns + i;
+        bez4_t *b = queue->beziers + i / 4;
+        route_t *route = turn->route;
+
+        if (!(i % 4))
+            bez4(b);
+        route->drawinfo->x = b->x[i%4];
+        route->drawinfo->z = b->z[i%4];
+        route->drawinfo->heading = b->heading[i%4];
+        route->steer = turn->steer_sign * route->drawinfo->heading + turn->steer_base;
+        if (route->state.backingup)
+        {
+            route->drawinfo->heading -= 180;
+            finishpose(route, -b->dx[i%4], -b->dz[i%4]);
+        }
+        else
+            finishpose(route, b->dx[i%4], b->dz[i%4]);
+    }
+    queue->nturns = 0;
+}
+
+
+/* Apply the object's offset and heading to the vehicle's position along its path.
+ * dx, dz is the unit vector along drawinfo->heading, i.e. its sin and -cos */
+static inline void finishpose(route_t *route, float dx, float dz)
+{
+    if (route->trail)
+        recordtrail(route, dx, dz);
+    if (route->object.offset)
+    {
+        route->drawinfo->x += dx * route->object.offset;
+        route->drawinfo->z += dz * route->object.offset;
+    }
+    if (route->steer)
+        route->steer = fmodf(route->steer + 540, 360) - 180;	/* to range -180..180 */
+    route->drawinfo->heading += route->object.heading;
+}
+
+
+/* Record where the head of a train is drawn this frame on its trail, before its object's offset and heading are applied.
+ * dx, dz is the unit vector along drawinfo->heading. Only touches the head's own trail, so is safe in the pose phase. */
+static void recordtrail(route_t *route, float dx, float dz)
+{
+    trail_t here, *point;
+
+    here.x = route->drawinfo->x;
+    here.y = route->drawinfo->y;
+    here.z = route->drawinfo->z;
+    here.heading = route->drawinfo->heading;
+    here.dx = dx;
+    here.dz = dz;
+    here.pitch = route->object.heading == 180 ? -route->drawinfo->pitch : route->object.heading ? 0 : route->drawinfo->pitch;
+    here.steer = route->steer;
+    here.distance = route->distance;
+    here.last_distance = route->last_distance;
+    here.next_distance = route->next_distance;
+    here.last_node = route->last_node;
+    here.next_node = route->next_node;
+    here.backingup = route->state.backingup;
+
+    if (!route->trailcount)
+    {
+        /* Just starting out, or after a discontinuity. Lay out a straight trail behind us for the cars to line up on */
+        float behind = (route->state.backingup ? 1 : -1) * (route->trailsize * TRAIL_STEP);	/* Opposite to travel */
+
+        point = route->trail;
+        *point = here;
+        point->odometer = 0;
+        point->x += behind * dx;
+        point->z += behind * dz;
+        point->steer = 0;
+        point->distance -= route->trailsize * TRAIL_STEP;	/* Negative at first node, as we would have been */
+        route->trailend = 0;
+        route->trailcount = 1;
+    }
+
+    /* The newest point is where we were last frame. Keep it if it's far enough from the one before, else overwrite it */
+    point = route->trail + route->trailend;
+    here.odometer = point->odometer + sqrtf((here.x - point->x) * (here.x - point->x) + (here.z - point->z) * (here.z - point->z));
+    if (route->trailcount < 2 ||
+        point->odometer - route->trail[route->trailend ? route->trailend - 1 : route->trailsize - 1].odometer >= TRAIL_STEP)
+    {
+        if (++route->trailend >= route->trailsize) route->trailend = 0;
+        if (route->trailcount < route->trailsize) route->trailcount++;
+    }
+    route->trail[route->trailend] = here;
+}
 
-    // assert (mu>=0 && mu<=1);	// Trains may go negative at start or in replay
 
-    mu2 = mu * mu;
-    mum1 = 1 - mu;
-    mum12 = mum1 * mum1;
-    drawinfo->x = p1->x * mum12 + 2 * p2->x * mum1 * mu + p3->x * mu2;
-    drawinfo->z = p1->z * mum12 + 2 * p2->z * mum1 * mu + p3->z * mu2;
+/* Place a train's car on its head's trail, at the car's lag behind the head, so that it follows exactly the same path.
+ * Called in the pose phase's second pass, once the heads have recorded where they are this frame. Only reads the head,
+ * so may be called from a pose worker thread. */
+static void followtrail(route_t *route)
+{
+    const route_t *head = route->parent;
+    const trail_t *behind, *ahead;
+    float odometer, t, heading, steer, pitch, dx, dz, len;
+    int k;
+
+    if (!(route->posed = head->posed && head->trailcount))
+        return;
 
-    tx = 2 * mum1 * (p2->x - p1->x) + 2 * mu * (p3->x - p2->x);
-    tz =-2 * mum1 * (p2->z - p1->z) - 2 * mu * (p3->z - p2->z);
-    drawinfo->heading = R2D(atan2f(tx, tz));
+    /* k points before the newest. Avoid integer division */
+#define TRAILPOINT(k) (head->trail + (head->trailend >= (k) ? head->trailend - (k) : head->trailend + head->trailsize - (k)))
+    odometer = TRAILPOINT(0)->odometer - (route->object.lag - head->object.lag) * route->speed;
+
+    /* We only move a little along the trail each frame, so search from where we were last frame rather than bisecting
+     * the whole trail - which would mean a cache miss or two per step */
+    if (head->trailcount < 2)
+    {
+        k = 0;
+    }
+    else
+    {
+        k = head->trailend - route->trailpoint;
+        if (k < 0) k += head->trailsize;
+        if (k < 1 || k >= head->trailcount) k = head->trailcount - 1;	/* Trail has been restarted */
+        while (k < head->trailcount - 1 && TRAILPOINT(k)->odometer > odometer)
+            k++;
+        while (k > 1 && TRAILPOINT(k-1)->odometer <= odometer)
+            k--;
+    }
+    behind = TRAILPOINT(k);	/* Behind the car, unless the trail doesn't reach back that far */
+    ahead = TRAILPOINT(k ? k-1 : 0);
+    route->trailpoint = behind - head->trail;
+#undef TRAILPOINT
+
+    t = ahead->odometer > behind->odometer ? fminf(fmaxf((odometer - behind->odometer) / (ahead->odometer - behind->odometer), 0), 1) : 0;
+
+    /* Consecutive points are close together, so their headings are nearly the same modulo 360. Avoid fmodf() - it's slow */
+    heading = ahead->heading - behind->heading;
+    while (heading > 180) heading -= 360;
+    while (heading < -180) heading += 360;
+    heading = behind->heading + t * heading;
+    steer = ahead->steer - behind->steer;
+    while (steer > 180) steer -= 360;
+    while (steer < -180) steer += 360;
+    steer = behind->steer + t * steer;
+    pitch = behind->pitch + t * (ahead->pitch - behind->pitch);
+    dx = behind->dx + t * (ahead->dx - behind->dx);
+    dz = behind->dz + t * (ahead->dz - behind->dz);
+    len = sqrtf(dx * dx + dz * dz);
+
+    route->drawinfo->x = behind->x + t * (ahead->x - behind->x);
+    route->drawinfo->y = behind->y + t * (ahead->y - behind->y);
+    route->drawinfo->z = behind->z + t * (ahead->z - behind->z);
+    route->drawinfo->heading = heading;
+    route->drawinfo->pitch = route->object.heading == 180 ? -pitch : route->object.heading ? 0 : pitch;
+    route->steer = steer;
+
+    /* For the car's DataRefs. Go by the point behind since distance is reset at the first node */
+    route->distance = behind->distance + (behind->backingup ? -t : t) * (ahead->odometer - behind->odometer);
+    route->last_distance = behind->last_distance;
+    route->next_distance = behind->next_distance;
+    route->last_node = behind->last_node;
+    route->next_node = behind->next_node;
+    route->state.backingup = behind->backingup;
+    route->state.frozen = head->state.paused || head->state.waiting || head->state.dataref || head->state.collision;
+
+    if (len > 0)
+        finishpose(route, dx / len, dz / len);
+    else
+        finishpose(route, behind->dx, behind->dz);	/* Turning right round at the end of a reversible route */
 }
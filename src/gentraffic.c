@@ -0,0 +1,83 @@
+/*
+ * GroundTraffic
+ *
+ * (c) Jonathan Harris 2013
+ *
+ * Licensed under GNU LGPL v2.1.
+ */
+
+/* Standalone generator of a synthetic GroundTraffic.txt for stress-testing collision avoidance and deadlock breaking.
+ * Build with "make -f Makefile.lin gentraffic", then e.g.:
+ *   gentraffic 1000 30 > "Custom Scenery/Stress/GroundTraffic.txt"	- long segments, so lots of crossings
+ *   gentraffic 1000 4  > "Custom Scenery/Stress/GroundTraffic.txt"	- short segments, so fewer crossings
+ * Fly to 47.015N 8.02E with a plugin built with DO_BENCHMARK, which logs the number of deadlocks broken and the number
+ * of routes left deadlocked (which should be 0) when the routes are deactivated.
+ * benchcollisions.sh uses this to time finding collisions between 100 to 10,000 routes.
+ * The same arguments always generate the same routes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LAT 47.0	/* South-west corner of the area */
+#define LON 8.0
+#define NLAT 300	/* Size of the area in steps of STEP degrees, ~3.3km x 3.0km */
+#define NLON 400
+#define STEP 0.0001
+#define MIN_NODES 2
+#define MAX_NODES 6
+#define REVERSE 40	/* Percentage of routes that reverse at their last waypoint rather than circle */
+#define SPEED 20	/* [km/h] */
+#define OBJECT "lib/airport/Ramp_Equipment/Luggage_Truck.obj"
+
+
+static int irand(int lo, int hi)
+{
+    return lo + rand() % (hi - lo + 1);
+}
+
+
+static int clamp(int i, int hi)
+{
+    return i < 0 ? 0 : (i > hi ? hi : i);
+}
+
+
+int main(int argc, char **argv)
+{
+    int nroutes, maxstep, i, j;
+
+    if (argc < 3 || argc > 5 || (nroutes = atoi(argv[1])) <= 0 || (maxstep = atoi(argv[2])) <= 0)
+    {
+        fprintf(stderr, "Usage: %s routes maxstep [seed [object]]\n"
+                "  routes\tNumber of routes to generate\n"
+                "  maxstep\tMaximum distance between waypoints in each of lat and lon, in steps of %g degrees\n"
+                "  seed\t\tRandom seed (default: routes)\n"
+                "  object\tObject to use (default: %s)\n", argv[0], STEP, OBJECT);
+        return 1;
+    }
+    srand(argc > 3 ? atoi(argv[3]) : nroutes);
+
+    for (i = 0; i < nroutes; i++)
+    {
+        int nnodes = irand(MIN_NODES, MAX_NODES);
+        int lat = irand(0, NLAT), lon = irand(0, NLON);
+
+        printf("\nroute %d 0 0 %s\n", SPEED, argc > 4 ? argv[4] : OBJECT);
+        for (j = 0; j < nnodes; j++)
+        {
+            int nlat, nlon;
+
+            printf("%.4f %.4f\n", LAT + lat * STEP, LON + lon * STEP);
+            do
+            {
+                nlat = clamp(lat + irand(-maxstep, maxstep), NLAT);
+                nlon = clamp(lon + irand(-maxstep, maxstep), NLON);
+            } while (nlat == lat && nlon == lon);	/* Consecutive waypoints must differ */
+            lat = nlat;
+            lon = nlon;
+        }
+        if (irand(1, 100) <= REVERSE)
+            printf("reverse\n");
+    }
+    return 0;
+}
@@ -26,9 +26,14 @@ float lod_bias = DEFAULT_LOD;
 airport_t airport = { 0 };
 int year=113;		/* Current year (in GMT tz) since 1900 */
 worker_t collision_worker = { 0 }, LOD_worker = { 0 };
+static float *LOD_jobs = NULL;		/* LODs that LOD_worker calculates, in routetbl order. 0 if not calculated yet */
 route_t *activating_route = NULL;
+route_t *pending_route = NULL;		/* Route whose object is being loaded asynchronously */
+static intptr_t pending_load = 0;	/* Identifies the latest async load, so that loadobject() can spot stale ones */
+route_t *deactivating_route = NULL;
 #ifdef DO_BENCHMARK
-struct timeval activating_loading_t1, activating_elapsed_t1;
+struct timeval activating_loading_t1, activating_elapsed_t1, deactivating_elapsed_t1;
+static int benchmark_first_ready, benchmark_all_ready;
 #endif
 
 /* Published DataRefs. Must be in same order as dataref_t */
@@ -46,6 +51,7 @@ const char *datarefs[] = {
 /* In this file */
 static XPLMWindowID labelwin = 0;
 static int done_new_airport = 0;
+static int ready_changed = 0;		/* Routes' objects have been (un)loaded, so need to call update_ready() */
 
 static int newairportcallback(XPLMDrawingPhase inPhase, int inIsBefore, void *inRefcon);
 static float flightcallback(float inElapsedSinceLastCall, float inElapsedTimeSinceLastFlightLoop, int inCounter, void *inRefcon);
@@ -54,6 +60,12 @@ static int intrefcallback(XPLMDataRef inRefCon);
 static int varrefcallback(XPLMDataRef inRefCon, float *outValues, int inOffset, int inMax);
 static int lookup_objects(airport_t *airport);
 static void activate2(airport_t *airport);
+static void update_ready(airport_t *airport);
+static void prioritize_loads(airport_t *airport);
+static cellmask_t cells_in_range(const airport_t *airport, float view_x, float view_y, float view_z);
+static int update_cells(airport_t *airport, float view_x, float view_y, float view_z);
+static int start_LOD_worker(airport_t *airport);
+static void finish_LOD_worker(airport_t *airport);
 static void *check_LODs(void *arg);
 static void *check_collisions(void *arg);
 
@@ -147,7 +159,10 @@ PLUGIN_API void XPluginDisable(void)
 {
     activating_route = NULL;	/* Discard any pending async object load */
     worker_stop(&LOD_worker);
+    finish_LOD_worker(&airport);
     worker_stop(&collision_worker);
+    stop_pose_workers();
+    stop_planes();
     clearconfig(&airport);
 }
 
@@ -196,25 +211,28 @@ PLUGIN_API void XPluginReceiveMessage(XPLMPluginID inFrom, long inMessage, void
 /* Check whether we've come into or gone out of range, return 1 if ready to draw */
 static int check_range(airport_t *airport)
 {
-    double airport_x, airport_y, airport_z;
     float view_x, view_y, view_z;
+    int cells_changed;
 
     int result = 0;
 
-    if (airport->state == inactive)
+    if (airport->state == deactivating)
+        deactivate2(airport, DEACTIVATE_BUDGET);	/* Continue unloading resources from a previous deactivation */
+
+    if (airport->state == inactive || airport->state == deactivating)
     {
         if (intilerange(airport->tower))
         {
             if (airport->tower.alt == (double) INVALID_ALT)
                 proberoutes(airport);	/* First time we've encountered our airport Determine elevations. */
 
-            XPLMWorldToLocal(airport->tower.lat, airport->tower.lon, airport->tower.alt, &airport_x, &airport_y, &airport_z);
+            mapcells(airport);		/* OpenGL projection may have shifted since we last looked */
             view_x=XPLMGetDataf(ref_view_x);
             view_y=XPLMGetDataf(ref_view_y);
             view_z=XPLMGetDataf(ref_view_z);
 
-            if (indrawrange(((float)airport_x)-view_x, ((float)airport_y)-view_y, ((float)airport_z)-view_z, airport->active_distance))
-                if (!activate(airport))	/* Going active. Will be synchronous if airport->new_airport. */
+            if (cells_in_range(airport, view_x, view_y, view_z))
+                if (!activate(airport))	/* Going active. Will be synchronous if airport->new_airport. Re-uses any resources not yet unloaded. */
                     clearconfig(airport);
         }
     }
@@ -226,17 +244,25 @@ static int check_range(airport_t *airport)
         }
         else
         {
-            XPLMWorldToLocal(airport->tower.lat, airport->tower.lon, airport->tower.alt, &airport_x, &airport_y, &airport_z);
+            mapcells(airport);
             view_x=XPLMGetDataf(ref_view_x);
             view_y=XPLMGetDataf(ref_view_y);
             view_z=XPLMGetDataf(ref_view_z);
 
-            if (!indrawrange(((float)airport_x)-view_x, ((float)airport_y)-view_y, ((float)airport_z)-view_z, airport->active_distance+ACTIVE_HYSTERESIS))
-                deactivate(airport);
-            else if (airport->state == activating && !activating_route)
-                activate2(airport);	/* obj loading is complete - check for completion of other tasks */
-            else if (airport->state == active && !activating_route) // nst0022 2.2
-                result = 1;
+            cells_changed = update_cells(airport, view_x, view_y, view_z);
+            if (!airport->live_cells)
+                deactivate(airport);	/* Every cell has gone out of range */
+            else
+            {
+                if (cells_changed)
+                    activating_route = airport->routes;	/* Cells have come into or gone out of range - (un)load routes' objects */
+                if ((activating_route || airport->loadnext < airport->loadcount || airport->state == activating) && !pending_route)
+                    activate2(airport);	/* Continue (un)loading objects, or check for completion of other tasks */
+                if (ready_changed && (airport->state == active || airport->state == activating))
+                    update_ready(airport);
+                if (airport->state == active || airport->state == activating) // nst0022 2.2
+                    result = 1;	/* Simulate and draw those routes that are ready */
+            }
         }
     }
 
@@ -478,40 +504,43 @@ float userrefcallback(XPLMDataRef inRefcon)
 /* Callback from XPLMLoadObjectAsync */
 static void loadobject(XPLMObjectRef inObject, void *inRef)
 {
-    if (!activating_route)
+    route_t *route = pending_route;
+
+    if (!route || (intptr_t) inRef != pending_load)
     {
         // nst0022 it appears, that XPLMDestroyInstance(activating_route->instance_ref); is necessary,
         //         but this code was never reached during testing
 
-        /* We were deactivated / disabled */
+        /* We were deactivated / disabled, possibly then re-activated and started another load - maybe of the same
+         * route - before this load completed */
         if (inObject) XPLMUnloadObject(inObject);
         return;
     }
+    pending_route = NULL;
 
-    assert ((route_t *) inRef == activating_route);
-
-    if (!(activating_route->object.objref = inObject))
+    if (!(route->object.objref = inObject))
     {
         char msg[MAX_NAME+64];
-        sprintf(msg, "Can't load object or train \"%s\"", activating_route->object.name);
+        sprintf(msg, "Can't load object or train \"%s\"", route->object.name);
         xplog(msg);
         worker_stop(&LOD_worker);
+        finish_LOD_worker(&airport);
         worker_stop(&collision_worker);
+        stop_pose_workers();
         clearconfig(&airport);
         return;
     }
 
-    activating_route = activating_route->next;
-#ifdef DO_BENCHMARK
-    if (!activating_route)
+    if (!route_live(&airport, route))
     {
-        struct timeval t2;
-        char msg[64];
-        gettimeofday(&t2, NULL);		/* stop */
-        sprintf(msg, "%d us in activate loading resources", (int) ((t2.tv_sec-activating_loading_t1.tv_sec) * 1000000 + t2.tv_usec - activating_loading_t1.tv_usec));
-        xplog(msg);
+        /* Its cell went out of range while we were loading */
+        XPLMUnloadObject(route->object.objref);
+        route->object.objref = 0;
+    }
+    else
+    {
+        ready_changed = -1;	/* Can start simulating it */
     }
-#endif
 
     /* Do next object. This can turn synchronous if the user placed the plane at our airport while we were loading */
     activate2(&airport);
@@ -520,16 +549,256 @@ static void loadobject(XPLMObjectRef inObject, void *inRef)
 
 /* Callback for sorting routes by draw order, so that objects are batched together.
  * Would ideally like to sort by texture since that's the most expensive thing, but we don't know that.
- * So settle for sorting by XPLMObjectRef.
+ * So settle for sorting by object file - XPLMObjectRefs come and go as cells go in and out of range.
  * Drawing code assumes parents come before children so cater to this - which means if the same object is used as
  * a parent and child it will occur in two separate batches. This isn't disastrous and anyway is unlikely to occur
  * in practice since it's unlikely that the same object would be used as both parent and child. */
 static int sortroute(const void *a, const void *b)
 {
     const route_t *const *ra = a, *const *rb = b;
+    int cmp;
     if ((*ra)->parent && !(*rb)->parent) return 1;
     if ((*rb)->parent && !(*ra)->parent) return -1;
-    return ((*ra)->object.objref > (*rb)->object.objref) - ((*ra)->object.objref < (*rb)->object.objref);	/* Simple (ra->object.objref - rb->object.objref) risks overflow */
+    if ((cmp = strcmp((*ra)->object.physical_name, (*rb)->object.physical_name))) return cmp;
+    return (*ra > *rb) - (*ra < *rb);	/* Total order */
+}
+
+
+/* Sort routes by object and assign XPLMDrawInfo_t entries in sequence so objects can be drawn in batches.
+ * The routes are then moved into one table in sorted order, so that the per-frame update in drawcallback() streams
+ * through memory rather than chasing the linked list around the heap. The linked list and parent pointers are fixed
+ * up to point into the table, as are highways' holders.
+ * Only done once, before any worker thread is started, since the worker threads walk the linked list. */
+static int sortroutes(airport_t *airport)
+{
+    route_t *route, **routes = NULL, *table = NULL;
+    int count, i;
+
+    for (count = 0, route = airport->routes; route; count++, route = route->next);
+    if (!(airport->drawinfo = calloc(count, sizeof(XPLMDrawInfo_t))) ||
+        !(airport->loadqueue = malloc(count * sizeof(loadqueue_t))) ||
+        !(airport->turns = malloc(count * sizeof(turn_t))) ||
+        !(airport->beziers = malloc((count+3)/4 * sizeof(bez4_t))) ||
+        !(table = malloc(count * sizeof(route_t))) ||
+        !(routes = malloc(count * sizeof(route))))
+    {
+        /* Routes are still in their original allocations, so leave them be */
+        free(airport->drawinfo);
+        airport->drawinfo = NULL;
+        free(airport->loadqueue);
+        airport->loadqueue = NULL;
+        free(airport->turns);
+        airport->turns = NULL;
+        free(airport->beziers);
+        airport->beziers = NULL;
+        free(table);
+        return xplog("Out of memory!");
+    }
+    for (i = 0; i<count; airport->drawinfo[i++].structSize = sizeof(XPLMDrawInfo_t));
+
+    for (i = 0, route = airport->routes; route; route = route->next)
+        routes[i++] = route;
+    qsort(routes, count, sizeof(route), sortroute);
+    for (i = 0; i < count; i++)
+    {
+        table[i] = *routes[i];
+        table[i].drawinfo = airport->drawinfo + i;
+        table[i].next = i < count-1 ? table + i+1 : NULL;
+        routes[i]->next = table + i;	/* Temporarily, so we can find where each route has moved to */
+    }
+    for (i = 0; i < count; i++)
+        if (table[i].parent)
+            table[i].parent = table[i].parent->next;
+        else if (table[i].highway)
+        {
+            int j;
+            for (j = 0; j < table[i].highway->obj_count; j++)
+                table[i].highway->holders[j] = table[i].highway->holders[j]->next;
+        }
+    airport->firstroute = airport->firstroute->next;
+    airport->routes = airport->routetbl = table;
+    airport->nroutes = count;
+    for (airport->nleaders = 0; airport->nleaders < count && !table[airport->nleaders].parent; airport->nleaders++);
+    for (i = 0; i < count; free(routes[i++]));
+    free(routes);
+    return 1;
+}
+
+
+/* Whether the route's timing is determined by its path - i.e. it doesn't wait for a time of day or a DataRef value,
+ * or back up - and it leads its train */
+static int seekable(const route_t *route)
+{
+    int i;
+
+    if (route->parent || route->highway || route->pathlen < 2)
+        return 0;
+    for (i=0; i<route->pathlen; i++)
+        if (route->path[i].attime[0] != INVALID_AT || route->path[i].whenrefs || route->path[i].flags.backup)
+            return 0;
+    return -1;
+}
+
+
+/* Lay out one cycle of each seekable route's path in time, so that seekroute() can find where the route would be at
+ * any time. Waiting for other routes isn't accounted for, but each time a route sets off on time it re-aligns its
+ * timeline with how it's actually got on.
+ * A cycle starts on arrival at the first waypoint. Reversible routes visit their intermediate waypoints once in each
+ * direction, so have two legs per waypoint other than the ends. Only done once, after sortroutes(). */
+static int maketimelines(airport_t *airport)
+{
+    route_t *route;
+    leg_t *leg;
+    int count = 0, i;
+
+    for (route = airport->routes; route; route = route->next)
+    {
+        route->timeline = NULL;
+        route->nlegs = route->path[route->pathlen-1].flags.reverse ? 2 * (route->pathlen-1) : route->pathlen;
+        if (seekable(route))
+            count += route->nlegs + 1;
+    }
+    if (!count)
+        return 1;
+    if (!(airport->legs = malloc(count * sizeof(leg_t))))
+        return xplog("Out of memory!");
+
+    for (route = airport->routes, leg = airport->legs; route; route = route->next)
+    {
+        float arrive = 0, distance = 0;
+
+        if (!seekable(route))
+            continue;
+
+        route->timeline = leg;
+        for (i=0; i<route->nlegs; i++, leg++)
+        {
+            /* Same waypoint sequence and distances as nextevent() */
+            int direction, node = leg_node(route, i, &direction);
+            float length = route->path[direction > 0 ? node : node-1].length;
+
+            leg->arrive = arrive;
+            leg->depart = arrive + route->path[node].pausetime;
+            leg->distance = node ? distance : (distance = 0);
+            distance += length;
+            arrive = leg->depart + length / route->speed;
+        }
+        leg->arrive = leg->depart = arrive;	/* End of cycle */
+        leg->distance = distance;
+        leg++;
+    }
+    return 1;
+}
+
+
+/* Priority for loading a route's object - distance from the view to the route's path as a proportion of the object's
+ * draw distance. The vehicle could be anywhere on its path so the nearest point on the path is our best guess.
+ * lod_factor is common to all routes so doesn't affect the order, and isn't known until we've drawn a frame. */
+static float loadpriority(const route_t *route, float view_x, float view_z)
+{
+    path_t *path = route->path;
+    int reversible = (route->highway || path[route->pathlen-1].flags.reverse) ? 1 : 0;
+    float dist2 = FLT_MAX;
+    int i;
+
+    for (i = 0; i < route->pathlen - reversible; i++)
+    {
+        point_t *p0 = &path[i].p, *p1 = &path[(i+1) % route->pathlen].p;
+        float dx = p1->x - p0->x, dz = p1->z - p0->z;
+        float len2 = dx*dx + dz*dz;
+        float t = len2 ? ((view_x - p0->x) * dx + (view_z - p0->z) * dz) / len2 : 0;
+        float x, z;
+
+        if (t < 0) t = 0; else if (t > 1) t = 1;
+        x = p0->x + t * dx - view_x;
+        z = p0->z + t * dz - view_z;
+        if (x*x + z*z < dist2) dist2 = x*x + z*z;
+    }
+    if (dist2 == FLT_MAX)	/* Single-node path */
+        dist2 = (path->p.x - view_x) * (path->p.x - view_x) + (path->p.z - view_z) * (path->p.z - view_z);
+
+    return sqrtf(dist2) / (route->object.drawlod ? route->object.drawlod : DEFAULT_DRAWLOD);	/* LOD may not be calculated yet */
+}
+
+
+/* Callback for sorting the load queue */
+static int sortload(const void *a, const void *b)
+{
+    const loadqueue_t *la = a, *lb = b;
+    if (la->priority != lb->priority) return la->priority < lb->priority ? -1 : 1;
+    return (la->route > lb->route) - (la->route < lb->route);	/* Total order */
+}
+
+
+/* Sort the routes remaining in the load queue so that the vehicles nearest the view, relative to their draw
+ * distance, are loaded first */
+static void prioritize_loads(airport_t *airport)
+{
+    float view_x = XPLMGetDataf(ref_view_x), view_z = XPLMGetDataf(ref_view_z);
+    int i;
+
+    for (i = airport->loadnext; i < airport->loadcount; i++)
+        airport->loadqueue[i].priority = loadpriority(airport->loadqueue[i].route, view_x, view_z);
+    qsort(airport->loadqueue + airport->loadnext, airport->loadcount - airport->loadnext, sizeof(loadqueue_t), sortload);
+    airport->load_x = view_x;
+    airport->load_z = view_z;
+}
+
+
+/* Routes are ready to be simulated and drawn once they're in range and their objects, and those of the rest of their
+ * train, are loaded. Instances are created as routes become ready. */
+static void update_ready(airport_t *airport)
+{
+    route_t *route;
+
+    ready_changed = 0;
+    for (route = airport->routes; route; route = route->next)
+        route->ready = route->object.objref && route_live(airport, route);
+    for (route = airport->routes; route; route = route->next)
+        if (route->parent && !route->highway && !route->ready)
+            route->parent->ready = 0;	/* Train isn't ready until all of its carriages are */
+    for (route = airport->routes; route; route = route->next)
+    {
+        if (route->parent && !route->highway)
+            route->ready = route->parent->ready;
+        else if (!route->ready && route->nreserved)
+            release_zones(route, -1);	/* Not being simulated, so stop blocking other routes */
+        if (route->waiters)
+            wake_waiters(route);	/* Whether we can go depends on whether he's ready */
+        if (route->ready && !route->instance_ref && !route->highway)	/* Highway cars have instances from the pool */
+            route->instance_ref = XPLMCreateInstance(route->object.objref, datarefs);
+    }
+
+#ifdef DO_BENCHMARK
+    if (!benchmark_first_ready)
+        for (route = airport->routes; route; route = route->next)
+            if (route->ready)
+            {
+                struct timeval t2;
+                char msg[64];
+                gettimeofday(&t2, NULL);		/* stop */
+                sprintf(msg, "%d us in activate until first vehicle", (int) ((t2.tv_sec-activating_elapsed_t1.tv_sec) * 1000000 + t2.tv_usec - activating_elapsed_t1.tv_usec));
+                xplog(msg);
+                benchmark_first_ready = -1;
+                break;
+            }
+    if (!benchmark_all_ready && lod_factor)	/* Need to have drawn a frame to know draw distances */
+    {
+        float view_x = XPLMGetDataf(ref_view_x), view_z = XPLMGetDataf(ref_view_z);
+        for (route = airport->routes; route; route = route->next)
+            if (!route->ready && route_live(airport, route) && loadpriority(route, view_x, view_z) < lod_factor)
+                break;		/* Still waiting for a vehicle that's probably within draw range */
+        if (!route)
+        {
+            struct timeval t2;
+            char msg[64];
+            gettimeofday(&t2, NULL);		/* stop */
+            sprintf(msg, "%d us in activate until all vehicles in draw range", (int) ((t2.tv_sec-activating_elapsed_t1.tv_sec) * 1000000 + t2.tv_usec - activating_elapsed_t1.tv_usec));
+            xplog(msg);
+            benchmark_all_ready = -1;
+        }
+    }
+#endif
 }
 
 
@@ -538,11 +807,14 @@ int activate(airport_t *airport)
 {
     userref_t *userref;
     extref_t *extref;
+    route_t *route;
     int i;
     const char *const pluginsigs[] = { "xplanesdk.examples.DataRefEditor", "com.leecbaker.datareftool", NULL };
     const char *const *pluginsig;
+    double airport_x, airport_y, airport_z;
 
-    assert (airport->state==inactive);
+    assert (airport->state==inactive || airport->state==deactivating);
+    deactivating_route = NULL;		/* Abandon any pending unload - activate2() will re-use whatever's still loaded */
 
 #ifdef DO_BENCHMARK
     gettimeofday(&activating_elapsed_t1, NULL);		/* start */
@@ -593,9 +865,10 @@ int activate(airport_t *airport)
     /* We have five further tasks on activation:
      * 1. lookup library objects and expand highway routes
      * 2. determine collisions between routes
-     * 3. ask X-Plane to load objects
+     * 3. ask X-Plane to load objects for routes in cells that are in range (and later as other cells come into range),
+     *    nearest first
      * 4. parse objects to determine LOD
-     * 5. sort routes by XPLMObjectRef for batched drawing
+     * 5. sort routes by object for batched drawing
      *
      * (1) takes typically a few milliseconds or tens of milliseconds for a complex config.
      * (2) can take a large number of seconds for a complex config with, say, 500 overlapping routes.
@@ -603,123 +876,174 @@ int activate(airport_t *airport)
      * the same .obj files) and can take a number of seconds.
      * (5) takes a few milliseconds.
      *
-     * (1) and (2) only need to be done on first activation. (3), (4) and (5) we have to do on every activation,
-     * since we unload objects on de-activation.
+     * (1), (2) and (5) only need to be done on first activation. (3) we have to do on every activation, since we
+     * unload objects on de-activation - except for any objects that deactivate2() hadn't yet got around to.
+     * (4) only has to parse objects that weren't parsed on a previous activation.
      *
-     * We do (1) immediately below, since (3) and (4) depend on its output.
-     * We do (3) and (4) in worker threads.
+     * We do (1) immediately below, since (3), (4) and (5) depend on its output.
+     * We do (5) immediately below, before starting the worker threads, since they walk the list of routes.
+     * We do (2) and (4) in worker threads.
      * XPSDK expects calls to be made from the main thread so we do (3) in the main thread, either synchronously
      * or asynchronously depending on whether the user has just placed their plane at our airport.
-     * We do (5) after the worker threads have completed, since it depends on (3)
+     * Each route is simulated and drawn as soon as its object, and those of the rest of its train, have loaded.
+     * Routes hold at their next waypoint until (2) has completed, since until then we don't know where they might meet.
      */
     if (!airport->done_first_activation)
     {
-        if (!lookup_objects(airport) || !worker_start(&collision_worker, check_collisions))
+        if (!lookup_objects(airport) || !sortroutes(airport) || !maketimelines(airport) ||
+            !worker_start(&collision_worker, check_collisions, NULL))
             return 0;
         airport->done_first_activation = -1;
     }
-    if (!worker_start(&LOD_worker, check_LODs)) return 0;
+    if (!start_LOD_worker(airport) || !start_pose_workers()) return 0;
 
-    /* Start loading objects */
+    for (route = airport->routes; route; route = route->next)
+        route->ready = 0;	/* If previously deactivated, just let it continue when and where it left off */
+    ready_changed = -1;
+#ifdef DO_BENCHMARK
+    benchmark_first_ready = benchmark_all_ready = 0;
+#endif
+
+    /* Start loading objects for routes in cells that are in range */
 #ifdef DO_BENCHMARK
     gettimeofday(&activating_loading_t1, NULL);		/* start */
 #endif
+    XPLMWorldToLocal(airport->tower.lat, airport->tower.lon, airport->tower.alt, &airport_x, &airport_y, &airport_z);
+    if (airport->p.x != airport_x || airport->p.y != airport_y || airport->p.z != airport_z)
+    {
+        /* OpenGL projection has shifted while we were inactive */
+        airport->p.x=airport_x;  airport->p.y=airport_y;  airport->p.z=airport_z;
+        maproutes(airport);
+    }
+    airport->live_cells = 0;
+    update_cells(airport, XPLMGetDataf(ref_view_x), XPLMGetDataf(ref_view_y), XPLMGetDataf(ref_view_z));
     airport->state = activating;
     activating_route = airport->routes;
-    if (!airport->new_airport)
-        XPLMLoadObjectAsync(activating_route->object.physical_name, loadobject, activating_route);
-    else
-        activate2(airport);	/* Synchronous */
+    activate2(airport);		/* Synchronous if airport->new_airport, otherwise kicks off async loading */
 
     return 2;
 }
 
 
-/* Contine going active - load resources. */
+/* Continue going active - load resources for routes in cells that are in range, and unload resources for routes
+ * in cells that have gone out of range. Also called while active whenever the set of cells in range changes. */
 static void activate2(airport_t *airport)
 {
-    route_t *route, **routes;
-    int count, i;
+    route_t *route;
+    int sync = airport->new_airport;	/* User has placed their plane at our airport. Load synchronously from here on. */
+    int pass = activating_route != NULL;	/* Continuing a pass over the routes */
+    long long t1 = clock_us();
 #ifdef DO_BENCHMARK
     struct timeval t2;
     char msg[64];
 #endif
 
-    if (airport->new_airport)
+    if (sync)
+        pending_route = NULL;	/* Ignore any outstanding async load */
+
+    if (!airport->done_collisions && worker_is_finished(&collision_worker))
+        airport->done_collisions = -1;	/* Can start avoiding collisions between routes */
+    if (LOD_jobs && worker_is_finished(&LOD_worker))
+        finish_LOD_worker(airport);	/* Can start culling routes by draw distance */
+
+    if (activating_route || airport->loadnext < airport->loadcount)
     {
-        /* User has placed their plane at our airport. Load synchronously from here on. */
+        if (activating_route == airport->routes)
+            airport->loadcount = airport->loadnext = 0;		/* Starting a new pass over the routes */
+
         while (activating_route)
         {
-            if (!(activating_route->object.objref = XPLMLoadObject(activating_route->object.physical_name)))
+            route = activating_route;
+            if (!route_live(airport, route))
             {
-                char msg[MAX_NAME+64];
-                sprintf(msg, "Can't load object or train \"%s\"", activating_route->object.name);
-                xplog(msg);
-                worker_stop(&LOD_worker);
-                worker_stop(&collision_worker);
-                clearconfig(airport);
+                /* May still be loaded from before an interrupted deactivation, or cell has gone out of range */
+                if (route->instance_ref)
+                {
+                    XPLMDestroyInstance(route->instance_ref);
+                    route->instance_ref = NULL;
+                }
+                if (route->object.objref)
+                {
+                    if (route->highway)
+                        dropcars(route->object.objref);
+                    XPLMUnloadObject(route->object.objref);
+                    route->object.objref = 0;
+                    ready_changed = -1;
+                }
+                route->ready = 0;
+            }
+            else if (!route->object.objref)	/* May still be loaded from before an interrupted deactivation */
+            {
+                airport->loadqueue[airport->loadcount++].route = route;
+            }
+            activating_route = route->next;
+
+            if (!sync && activating_route && clock_us() - t1 >= ACTIVATE_BUDGET)
+                return;		/* Resume next frame */
+        }
+        if (pass)
+            prioritize_loads(airport);
+
+        while (airport->loadnext < airport->loadcount)
+        {
+            route = airport->loadqueue[airport->loadnext].route;
+            if (!route_live(airport, route) || route->object.objref)
+            {
+                airport->loadnext++;	/* Cell has gone out of range, or already loaded */
+            }
+            else if (sync)
+            {
+                if (!(route->object.objref = XPLMLoadObject(route->object.physical_name)))
+                {
+                    char msg[MAX_NAME+64];
+                    sprintf(msg, "Can't load object or train \"%s\"", route->object.name);
+                    xplog(msg);
+                    worker_stop(&LOD_worker);
+                    finish_LOD_worker(airport);
+                    worker_stop(&collision_worker);
+                    stop_pose_workers();
+                    clearconfig(airport);
+                    return;
+                }
+                airport->loadnext++;
+                ready_changed = -1;
+            }
+            else
+            {
+                /* Async - re-prioritize if the view has moved significantly, else load next. Continue in loadobject() */
+                float view_x = XPLMGetDataf(ref_view_x), view_z = XPLMGetDataf(ref_view_z);
+                if ((view_x - airport->load_x) * (view_x - airport->load_x) + (view_z - airport->load_z) * (view_z - airport->load_z) > LOAD_RESORT_DISTANCE * LOAD_RESORT_DISTANCE)
+                {
+                    prioritize_loads(airport);
+                    continue;
+                }
+                pending_route = route;	/* Left at head of the queue, so is re-tried if we turn synchronous */
+                XPLMLoadObjectAsync(route->object.physical_name, loadobject, (void *) ++pending_load);
                 return;
             }
-            activating_route = activating_route->next;
         }
         airport->new_airport = 0;
+
+        if (airport->state == active)
+            return;		/* Just (de)activating cells */
 #ifdef DO_BENCHMARK
         gettimeofday(&t2, NULL);		/* stop */
         sprintf(msg, "%d us in activate loading resources", (int) ((t2.tv_sec-activating_loading_t1.tv_sec) * 1000000 + t2.tv_usec - activating_loading_t1.tv_usec));
         xplog(msg);
 #endif
     }
-    else if (activating_route)
-    {
-        /* Async - load next */
-        XPLMLoadObjectAsync(activating_route->object.physical_name, loadobject, activating_route);
-        return;
-    }
-    else if (!worker_is_finished(&LOD_worker) || !worker_is_finished(&collision_worker))
+
+    if (airport->state == active || (!sync && (!worker_is_finished(&LOD_worker) || !airport->done_collisions)))
     {
-        /* Async loading done, but other tasks not done */
+        /* Loading done, but other tasks not done */
         return;
     }
 
     /* All done */
     worker_wait(&LOD_worker);
+    finish_LOD_worker(airport);
     worker_wait(&collision_worker);
-
-    /* Sort routes by XPLMObjectRef and assign XPLMDrawInfo_t entries in sequence so objects can be drawn in batches.
-     * Rather than actually shuffling the routes around in memory we just sort an array of pointers and then go back
-     * and fix up the linked list and pointers into the XPLMDrawInfo_t array. */
-    for (count = 0, route = airport->routes; route; count++, route = route->next)
-    {
-        if (route->highway)		/* If previously deactivated, just let it continue when and where it left off */
-            route->next_time=0;		/* apart from highways, which always need resetting to maintain spacing */
-    }
-    if (!airport->drawinfo)
-    {
-        if (!(airport->drawinfo = calloc(count, sizeof(XPLMDrawInfo_t))))
-        {
-            xplog("Out of memory!");
-            clearconfig(airport);
-            return;
-        }
-        for (i = 0; i<count; airport->drawinfo[i++].structSize = sizeof(XPLMDrawInfo_t));
-    }
-    if (!(routes = malloc(count * sizeof(route))))
-    {
-        xplog("Out of memory!");
-        clearconfig(airport);
-        return;
-    }
-    for (i = 0, route = airport->routes; route; route = route->next)
-        routes[i++] = route;
-    qsort(routes, count, sizeof(route), sortroute);
-    airport->routes = routes[0];
-    for (i = 0; i < count; i++)
-    {
-        routes[i]->drawinfo = airport->drawinfo + i;
-        routes[i]->next = i < count-1 ? routes[i+1] : NULL;
-        routes[i]->instance_ref = XPLMCreateInstance(routes[i]->object.objref, datarefs);
-    }
-    free(routes);
+    airport->done_collisions = -1;
 
     XPLMEnableFeature("XPLM_WANTS_REFLECTIONS", airport->reflections);
     //XPLMRegisterDrawCallback(drawcallback, xplm_Phase_Objects, 0, NULL);	/* After other 3D objects */
@@ -767,7 +1091,7 @@ static void enumeratehighwayobj(const char *inFilePath, void *inRef)
 }
 
 
-/* Lookup object names. Turn highways into multiple routes. */
+/* Lookup object names. Give highways a route to hold each of their physical objects, and work out how many cars. */
 static int lookup_objects(airport_t *airport)
 {
     route_t *route;
@@ -785,7 +1109,7 @@ static int lookup_objects(airport_t *airport)
         if (route->highway && !route->parent)		/* Unexpanded highway */
         {
             highway_t *highway = route->highway;
-            float path_dist, path_cumul;
+            float path_dist;
             int i;
             int count = 0;	/* Number of physical objects */
 
@@ -832,44 +1156,41 @@ static int lookup_objects(airport_t *airport)
                 }
             }
 
-            /* Measure route path length */
-            path_dist = 0;
-            for (i=1; i<route->pathlen; i++)
-            {
-                path_t *node = route->path+i, *prev = route->path+i-1;
-                path_dist += hypotf(node->p.x - prev->p.x, node->p.z - prev->p.z);
-            }
-
-            /* This route becomes the parent and always exists even if DataRef draw_cars_05 == 0 */
+            /* One car at the start of the path, which always exists even if DataRef draw_cars_05 == 0, and zero or
+             * more cars spaced out behind it. They're only drawn once they're in range - see flowhighway() */
+            path_dist = route->path[route->pathlen-1].cumul;	/* Route path length */
+            highway->ncars = 1;
+            if (drawcars > 0)
             {
-                objdef_t *objdef = highway->expanded + (rand() / (RAND_MAX / highway->obj_count + 1));
-                if (!(route->object.physical_name = strdup(objdef->physical_name)))
-                    return xplog("Out of memory!");
-                route->object.offset  = objdef->offset;
-                route->object.heading = objdef->heading;
+                highway->spacing *= (drawcars <= 5 ? 6-drawcars : 1);
+                highway->ncars += (int) fmaxf(path_dist / highway->spacing - (1-HIGHWAY_VARIANCE), 0);
             }
+            highway->seed = rand();
+            if (!(highway->holders = malloc(highway->obj_count * sizeof(route_t *))) ||
+                !(highway->drawn = calloc((highway->ncars + 7) / 8, 1)))
+                return xplog("Out of memory!");
 
-            /* Generate zero or more new child routes */
-            if (drawcars > 0)
+            /* This route holds the first object, and new child routes hold the others */
+            for (i=0; i<highway->obj_count; i++)
             {
-                float spacing = highway->spacing * (drawcars <= 5 ? 6-drawcars : 1);
+                objdef_t *objdef = highway->expanded + i;
+                route_t *newroute;
 
-                for (path_cumul = spacing; path_cumul <= path_dist - (1-HIGHWAY_VARIANCE) * spacing; path_cumul += spacing)
+                if (!i)
+                    newroute = route;
+                else if (!(newroute = malloc(sizeof(route_t))))
+                    return xplog("Out of memory!");
+                else
                 {
-                    route_t *newroute;
-                    objdef_t *objdef = highway->expanded + (rand() / (RAND_MAX / highway->obj_count + 1));
-
-                    if (!(newroute = malloc(sizeof(route_t))))
-                        return xplog("Out of memory!");
                     memcpy(newroute, route, sizeof(route_t));
                     route->next = newroute;
-                    if (!(newroute->object.physical_name = strdup(objdef->physical_name)))
-                        return xplog("Out of memory!");
-                    newroute->object.offset  = objdef->offset;
-                    newroute->object.heading = objdef->heading;
                     newroute->parent = route;
-                    newroute->highway_offset = path_cumul + HIGHWAY_VARIANCE * spacing * ((float) rand() / RAND_MAX - 0.5f);
                 }
+                if (!(newroute->object.physical_name = strdup(objdef->physical_name)))
+                    return xplog("Out of memory!");
+                newroute->object.offset  = objdef->offset;
+                newroute->object.heading = objdef->heading;
+                highway->holders[i] = newroute;
             }
 
             for (i=0; i<highway->obj_count; free(highway->expanded[i++].physical_name));
@@ -886,6 +1207,7 @@ static int lookup_objects(airport_t *airport)
                 /* Pick one at random (temporarily abuse deadlock variable as a counter) */
                 route->deadlocked = rand() % count;	/* rand() doesn't give an even distribution; I don't care */
                 XPLMLookupObjects(route->object.name, airport->tower.lat, airport->tower.lon, chooselibraryobj, route);
+                route->deadlocked = 0;
             }
             else
             {
@@ -919,6 +1241,39 @@ static int lookup_objects(airport_t *airport)
 }
 
 
+/* Start calculating LODs in the background. The worker writes them to LOD_jobs rather than to the routes, since
+ * drawcallback() reads routes' drawlod while it runs, and finish_LOD_worker() copies them across once it has stopped */
+static int start_LOD_worker(airport_t *airport)
+{
+    int i;
+
+    if (!(LOD_jobs = malloc(airport->nroutes * sizeof(float))))
+        return xplog("Out of memory!");
+    for (i=0; i<airport->nroutes; i++)
+        LOD_jobs[i] = airport->routetbl[i].object.drawlod;	/* Calculated on a previous activation, or 0 */
+    if (!worker_start(&LOD_worker, check_LODs, NULL))
+    {
+        free(LOD_jobs);
+        LOD_jobs = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+
+/* LOD worker has finished or been stopped - apply the LODs that it calculated to the routes */
+static void finish_LOD_worker(airport_t *airport)
+{
+    int i;
+
+    if (!LOD_jobs) return;
+    for (i=0; i<airport->nroutes; i++)
+        airport->routetbl[i].object.drawlod = LOD_jobs[i];
+    free(LOD_jobs);
+    LOD_jobs = NULL;
+}
+
+
 /*
  * Emulate X-Plane's LOD calculation for scenery objects
  *
@@ -932,31 +1287,32 @@ static int lookup_objects(airport_t *airport)
  */
 static void *check_LODs(void *arg)
 {
-    route_t *route;
+    int i, j;
 #ifdef DO_BENCHMARK
     char msg[64];
     struct timeval t1, t2;
     gettimeofday(&t1, NULL);		/* start */
 #endif
 
-    for (route=airport.routes; route; route=route->next)
+    for (i=0; i<airport.nroutes; i++)
     {
+        route_t *route = airport.routetbl + i;
         FILE *h;
-        route_t *other;
         char line[MAX_NAME+64];
         float height=0, lod=0;
 
         worker_check_stop(&LOD_worker);
 
+        if (LOD_jobs[i]) continue;	/* Done on a previous activation */
+
         /* If we've already loaded this object then use its LOD */
-        route->object.drawlod = 0;
-        for (other = airport.routes; other!=route; other = other->next)
-            if (!strcmp(route->object.physical_name, other->object.physical_name))
+        for (j=0; j<i; j++)
+            if (!strcmp(route->object.physical_name, airport.routetbl[j].object.physical_name))
             {
-                route->object.drawlod = other->object.drawlod;
+                LOD_jobs[i] = LOD_jobs[j];
                 break;
             }
-        if (route->object.drawlod) continue;
+        if (LOD_jobs[i]) continue;
 
         if (!(h=fopen(route->object.physical_name, "r")))
         {
@@ -966,7 +1322,7 @@ static void *check_LODs(void *arg)
             sprintf(msg, "Can't parse \"%s\"", route->object.physical_name);
             xplog(msg);
 #endif
-            route->object.drawlod = DEFAULT_DRAWLOD;
+            LOD_jobs[i] = DEFAULT_DRAWLOD;
             continue;
         }
 
@@ -985,9 +1341,9 @@ static void *check_LODs(void *arg)
         fclose(h);
 
         if (lod)
-            route->object.drawlod = 0.0007f * lod;
+            LOD_jobs[i] = 0.0007f * lod;
         else if (height)
-            route->object.drawlod = 0.65f * height;
+            LOD_jobs[i] = 0.65f * height;
         else
         {
 #ifdef DEBUG
@@ -995,7 +1351,7 @@ static void *check_LODs(void *arg)
             sprintf(msg, "Can't parse \"%s\"", route->object.physical_name);
             xplog(msg);
 #endif
-            route->object.drawlod = DEFAULT_DRAWLOD;	/* Perhaps a v7 object? */
+            LOD_jobs[i] = DEFAULT_DRAWLOD;	/* Perhaps a v7 object? */
         }
     }
 
@@ -1009,134 +1365,464 @@ static void *check_LODs(void *arg)
 }
 
 
-/* Check for collisions - O(n * log(n) * m^2) ! */
-static void *check_collisions(void *arg)
+/* Callback for sorting collisions into the order in which we'd find them by comparing every pair of routes */
+static int sorthit(const void *a, const void *b)
 {
-    route_t *route, *other;
-#ifdef DO_BENCHMARK
-    char buffer[64];
-    struct timeval t1, t2;
-    gettimeofday(&t1, NULL);		/* start */
-#endif
+    const hit_t *ha = a, *hb = b;
+    if (ha->route != hb->route) return ha->route - hb->route;
+    if (ha->other != hb->other) return ha->other - hb->other;
+    if (ha->node  != hb->node)  return ha->node  - hb->node;
+    return ha->othernode - hb->othernode;
+}
 
-    for (route=airport.routes; route; route=route->next)
+
+/* How far along p0->p1 p2->p3 crosses it, as a fraction of its length. Co-located end nodes cross at the end */
+static float crossing(const loc_t *p0, const loc_t *p1, const loc_t *p2, const loc_t *p3)
+{
+    float s1_x = p1->lon - p0->lon, s1_y = p1->lat - p0->lat;
+    float s2_x = p3->lon - p2->lon, s2_y = p3->lat - p2->lat;
+    float d = s1_x * s2_y - s2_x * s1_y;
+
+    if ((p1->lat == p3->lat && p1->lon == p3->lon) || !d)
+        return 1;
+    return fminf(fmaxf((s2_x * (p0->lat - p2->lat) - s2_y * (p0->lon - p2->lon)) / d, 0), 1);
+}
+
+
+/* Index of the cell containing x in a grid of n cells of size dx starting at x0 */
+static inline int gridindex(float x, float x0, float dx, int n)
+{
+    int i;
+    if (!dx) return 0;
+    i = (int) ((x - x0) / dx);
+    return i < n ? i : n-1;
+}
+
+static inline int gridcell(const collision_grid_t *grid, float lat, float lon)
+{
+    return gridindex(lat, grid->bounds.minlat, grid->dlat, grid->cells_lat) * grid->cells_lon +
+        gridindex(lon, grid->bounds.minlon, grid->dlon, grid->cells_lon);
+}
+
+
+/* Record a collision found by a collision_task. Returns 0 if out of memory */
+static int addhit(collision_task_t *task, const segment_t *rseg, const segment_t *oseg)
+{
+    if (task->nhits >= task->maxhits)
     {
-        worker_check_stop(&collision_worker);
+        hit_t *newhits;
+        if (!(newhits = realloc(task->hits, (task->maxhits = task->maxhits ? 2 * task->maxhits : 256) * sizeof(hit_t))))
+            return 0;
+        task->hits = newhits;
+    }
+    task->hits[task->nhits].route = rseg->route;
+    task->hits[task->nhits].node  = rseg->node;
+    task->hits[task->nhits].other = oseg->route;
+    task->hits[task->nhits].othernode = oseg->node;
+    task->nhits++;
+    return -1;
+}
 
-        if (!route->parent && !route->highway)		/* Skip child routes and highways */
-        {
-            int rrev = route->path[route->pathlen-1].flags.reverse;
 
-            for (other=route->next; other; other=other->next)
-            {
-                int orev = other->path[other->pathlen-1].flags.reverse;
-                int r0, r1;
+/* Test segment p0->p1 against a batch of up to four other segments. Returns 0 if out of memory */
+static int addhits(collision_task_t *task, const segment_t *rseg, const loc_t *p0, const loc_t *p1, const segment_t *osegs[4], int n,
+                   const float lon2[4], const float lat2[4], const float lon3[4], const float lat3[4])
+{
+    int mask = intersect4(p0->lon, p0->lat, p1->lon, p1->lat, lon2, lat2, lon3, lat3);
+    int i;
 
-                if (other->parent || other->highway || !bbox_intersect(&route->bbox, &other->bbox))
-                    continue;	/* Skip child routes and non-intersecting routes */
+    for (i=0; i<n; i++)
+    {
+#ifdef DEBUG
+        const route_t *other = task->grid->routes[osegs[i]->route];
+        assert (((mask >> i) & 1) == loc_intersect((loc_t *) p0, (loc_t *) p1,
+                                                   &other->path[osegs[i]->node].waypoint,
+                                                   &other->path[(osegs[i]->node+1) % other->pathlen].waypoint));
+#endif
+        if ((mask & (1 << i)) && !addhit(task, rseg, osegs[i]))
+            return 0;
+    }
+    return -1;
+}
 
-                for (r0=0; r0 < route->pathlen; r0++)
-                {
-                    int o0, o1;
-                    loc_t *p0, *p1;
-                    bbox_t rbox;
 
-                    if ((r1 = r0+1) == route->pathlen)
-                    {
-                        if (rrev)
-                            break;	/* Reversible routes don't circle back */
-                        else
-                            r1=0;
-                    }
-                    p0 = &route->path[r0].waypoint;
-                    p1 = &route->path[r1].waypoint;
-                    bbox_init(&rbox);
-                    bbox_add(&rbox, p0->lat, p0->lon);
-                    bbox_add(&rbox, p1->lat, p1->lon);
+/* Compare segments of different routes that share a cell, for every ntasks'th cell.
+ * Runs in its own thread, or in collision_worker's thread for the first task. */
+static void *collision_task(void *arg)
+{
+    collision_task_t *task = arg;
+    const collision_grid_t *grid = task->grid;
+    int i;
 
-                    for (o0=0; o0 < other->pathlen; o0++)
-                    {
-                        loc_t *p2, *p3;
-                        bbox_t obox;
+    for (i = task->first; i < grid->cells_lat * grid->cells_lon; i += grid->ntasks)
+    {
+        int a, b;
 
-                        if ((o1 = o0+1) == other->pathlen)
-                        {
-                            if (orev)
-                                break;	/* Reversible routes don't circle back */
-                            else
-                                o1=0;
-                        }
-                        p2 = &other->path[o0].waypoint;
-                        p3 = &other->path[o1].waypoint;
-                        bbox_init(&obox);
-                        bbox_add(&obox, p2->lat, p2->lon);
-                        bbox_add(&obox, p3->lat, p3->lon);
+        MemoryBarrier();
+        if (collision_worker.die_please)
+            break;
 
-                        if ((p1->lat == p3->lat && p1->lon == p3->lon) || (bbox_intersect(&rbox, &obox) && loc_intersect(p0, p1, p2, p3)))
-                        {
-                            /* Co-located path segment end nodes or segments intersect = Collision */
-                            collision_t *newc;
-
-                            if (!(newc=malloc(sizeof(collision_t))))
-                            {
-                                xplog("Out of memory!");
-                                worker_has_finished(&collision_worker);
-                                return NULL;
-                            }
-                            newc->route = other;
-                            newc->node = o0;
-                            newc->next = route->path[r0].collisions;
-                            route->path[r0].collisions = newc;
-
-                            if (!(newc=malloc(sizeof(collision_t))))
-                            {
-                                xplog("Out of memory!");
-                                worker_has_finished(&collision_worker);
-                                return NULL;
-                            }
-                            newc->route = route;
-                            newc->node = r0;
-                            newc->next = other->path[o0].collisions;
-                            other->path[o0].collisions = newc;
-                        }
+        for (a = grid->cellstart[i]; a < grid->cellstart[i+1]; a++)
+        {
+            segment_t *rseg = grid->segs + grid->cellsegs[a];
+            route_t *route = grid->routes[rseg->route];
+            loc_t *p0 = &route->path[rseg->node].waypoint;
+            loc_t *p1 = &route->path[(rseg->node+1) % route->pathlen].waypoint;
+            const segment_t *osegs[4];
+            float lon2[4] = { 0 }, lat2[4] = { 0 }, lon3[4] = { 0 }, lat3[4] = { 0 };
+            int n = 0;
+
+            for (b = a+1; b < grid->cellstart[i+1]; b++)
+            {
+                segment_t *oseg = grid->segs + grid->cellsegs[b];
+                route_t *other;
+                loc_t *p2, *p3;
+
+                if (grid->cached[rseg->route] >= 0 && grid->cached[oseg->route] > grid->cached[rseg->route])
+                    continue;	/* Restored from the collision cache */
+                if (rseg->route == oseg->route ||
+                    gridcell(grid, fmaxf(rseg->bbox.minlat, oseg->bbox.minlat), fmaxf(rseg->bbox.minlon, oseg->bbox.minlon)) != i)
+                    continue;	/* Same route, or will be / has been compared in another cell */
+
+                other = grid->routes[oseg->route];
+                if (!bbox_intersect(&route->bbox, &other->bbox))
+                    continue;	/* Non-intersecting routes */
+
+                p2 = &other->path[oseg->node].waypoint;
+                p3 = &other->path[(oseg->node+1) % other->pathlen].waypoint;
+                if (p1->lat == p3->lat && p1->lon == p3->lon)
+                {
+                    /* Co-located path segment end nodes = Collision */
+                    if (!addhit(task, rseg, oseg))
+                        break;
+                }
+                else if (bbox_intersect(&rseg->bbox, &oseg->bbox))
+                {
+                    /* Segments might intersect = Collision. Test in batches */
+                    osegs[n] = oseg;
+                    lon2[n] = p2->lon;  lat2[n] = p2->lat;
+                    lon3[n] = p3->lon;  lat3[n] = p3->lat;
+                    if (++n == 4)
+                    {
+                        if (!addhits(task, rseg, p0, p1, osegs, n, lon2, lat2, lon3, lat3))
+                            break;
+                        n = 0;
                     }
                 }
             }
+            if ((b < grid->cellstart[i+1]) || (n && !addhits(task, rseg, p0, p1, osegs, n, lon2, lat2, lon3, lat3)))
+            {
+                task->failed = -1;	/* Out of memory */
+                worker_has_finished(&task->worker);
+                return NULL;
+            }
+        }
+    }
+
+    if (task->nhits) qsort(task->hits, task->nhits, sizeof(hit_t), sorthit);
+    worker_has_finished(&task->worker);
+    return NULL;
+}
+
+
+/* Check for collisions.
+ * Path segments are put into a grid of cells by their bounding boxes, so we only need to compare segments that share
+ * a cell - O(n * m) for n routes of m segments, rather than the O(n^2 * m^2) of comparing every pair of routes.
+ * A pair of segments whose bounding boxes overlap will share several cells if they're long, so each pair is only
+ * compared in the cell containing the south-west corner of the overlap.
+ * The cells are shared out between a number of threads, each of which sorts the collisions that it finds into the
+ * order in which we'd find them by comparing every pair of routes. These are then merged so that routes' lists of
+ * collisions come out in the same order regardless of the number of threads, since that order determines which
+ * collision a route waits for first.
+ * Collisions between routes that haven't changed since last time are restored from the collision cache instead. */
+static void *check_collisions(void *arg)
+{
+    static collision_task_t tasks[MAX_COLLISION_THREADS+1];	/* Last holds collisions restored from the cache */
+    collision_task_t *restored = tasks + MAX_COLLISION_THREADS;
+    collision_grid_t grid = { 0 };
+    zone_t *zone;
+    collision_t *newc;
+    loc_t *p0, *p1, *p2, *p3;
+    route_t *route;
+    int nroutes = 0, nsegs = 0;
+    int maxcells, ncells, i, j, k;
+    int result = 0;
+#ifdef DO_BENCHMARK
+    char buffer[128];
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);		/* start */
+#endif
+
+    /* Collect path segments of routes. Skip child routes and highways */
+    for (route=airport.routes; route; route=route->next)
+        if (!route->parent && !route->highway)
+        {
+            nroutes++;
+            nsegs += route->path[route->pathlen-1].flags.reverse ? route->pathlen-1 : route->pathlen;	/* Reversible routes don't circle back */
+        }
+    if (!nsegs)
+    {
+        worker_has_finished(&collision_worker);
+        return NULL;
+    }
+    memset(tasks, 0, sizeof(tasks));
+    if (!(grid.routes = malloc(nroutes * sizeof(route_t*))) || !(grid.segs = malloc(nsegs * sizeof(segment_t))))
+        goto fail;
+
+    bbox_init(&grid.bounds);
+    for (nroutes = nsegs = 0, route=airport.routes; route; route=route->next)
+        if (!route->parent && !route->highway)
+        {
+            int n = route->path[route->pathlen-1].flags.reverse ? route->pathlen-1 : route->pathlen;
+            for (i=0; i<n; i++)
+            {
+                loc_t *p0 = &route->path[i].waypoint;
+                loc_t *p1 = &route->path[(i+1) % route->pathlen].waypoint;
+                segment_t *seg = grid.segs + nsegs++;
+
+                seg->route = nroutes;
+                seg->node = i;
+                bbox_init(&seg->bbox);
+                bbox_add(&seg->bbox, p0->lat, p0->lon);
+                bbox_add(&seg->bbox, p1->lat, p1->lon);
+                bbox_add(&grid.bounds, p0->lat, p0->lon);
+                bbox_add(&grid.bounds, p1->lat, p1->lon);
+                grid.dlat += seg->bbox.maxlat - seg->bbox.minlat;
+                grid.dlon += seg->bbox.maxlon - seg->bbox.minlon;
+            }
+            grid.routes[nroutes++] = route;
+        }
+
+    if (!read_collision_cache(&grid, nroutes, restored))
+        goto fail;
+    if (restored->nhits)
+        qsort(restored->hits, restored->nhits, sizeof(hit_t), sorthit);
+    if (!grid.cache_dirty)
+        goto merge;	/* Everything restored */
+
+    /* Cells are at least the size of the average segment, so that most segments only occupy a few cells.
+     * And there's no point in having many more cells than segments. */
+    maxcells = (int) sqrtf((float) nsegs) + 1;
+    if (maxcells > MAX_COLLISION_CELLS) maxcells = MAX_COLLISION_CELLS;
+    grid.dlat = grid.dlat / nsegs;
+    grid.dlon = grid.dlon / nsegs;
+    if (grid.dlat < (grid.bounds.maxlat - grid.bounds.minlat) / maxcells) grid.dlat = (grid.bounds.maxlat - grid.bounds.minlat) / maxcells;
+    if (grid.dlon < (grid.bounds.maxlon - grid.bounds.minlon) / maxcells) grid.dlon = (grid.bounds.maxlon - grid.bounds.minlon) / maxcells;
+    grid.cells_lat = grid.dlat ? (int) ((grid.bounds.maxlat - grid.bounds.minlat) / grid.dlat) + 1 : 1;
+    grid.cells_lon = grid.dlon ? (int) ((grid.bounds.maxlon - grid.bounds.minlon) / grid.dlon) + 1 : 1;
+    if (grid.cells_lat > maxcells) grid.cells_lat = maxcells;	/* Rounding */
+    if (grid.cells_lon > maxcells) grid.cells_lon = maxcells;
+    ncells = grid.cells_lat * grid.cells_lon;
+
+    /* Bucket segments into cells. Each cell's segments are in the same order as the routes */
+    if (!(grid.cellstart = calloc(ncells + 1, sizeof(int))))
+        goto fail;
+    for (j=0; j<2; j++)		/* Count, then fill */
+    {
+        if (j)
+        {
+            for (i=1; i < ncells; i++)
+                grid.cellstart[i] += grid.cellstart[i-1];		/* Now holds the end of each cell's segments */
+            grid.cellstart[i] = grid.cellstart[i-1];
+            if (!(grid.cellsegs = malloc(grid.cellstart[i] * sizeof(int))))
+                goto fail;
+        }
+        for (i=nsegs-1; i>=0; i--)	/* Backwards since we fill each cell from its end */
+        {
+            int c0 = gridcell(&grid, grid.segs[i].bbox.minlat, grid.segs[i].bbox.minlon);
+            int c1 = gridcell(&grid, grid.segs[i].bbox.maxlat, grid.segs[i].bbox.maxlon);
+            int lat, lon;
+            for (lat = c0 / grid.cells_lon; lat <= c1 / grid.cells_lon; lat++)
+                for (lon = c0 % grid.cells_lon; lon <= c1 % grid.cells_lon; lon++)
+                    if (j)
+                        grid.cellsegs[--grid.cellstart[lat * grid.cells_lon + lon]] = i;	/* Ends up holding the start */
+                    else
+                        grid.cellstart[lat * grid.cells_lon + lon]++;
         }
     }
 
+    /* Compare segments in parallel, leaving a core for X-Plane's main thread */
+    grid.ntasks = cpu_count() - 1;
+    if (airport.maxthreads && grid.ntasks > airport.maxthreads) grid.ntasks = airport.maxthreads;
+    if (grid.ntasks > nsegs / COLLISION_TASK_SEGS + 1) grid.ntasks = nsegs / COLLISION_TASK_SEGS + 1;
+    if (grid.ntasks > MAX_COLLISION_THREADS) grid.ntasks = MAX_COLLISION_THREADS;
+    if (grid.ntasks < 1) grid.ntasks = 1;
+    for (i=0; i < grid.ntasks; i++)
+    {
+        tasks[i].grid = &grid;
+        tasks[i].first = i;
+        if (i && !worker_start(&tasks[i].worker, collision_task, tasks + i))
+            collision_task(tasks + i);	/* Do it ourselves */
+    }
+    collision_task(tasks);
+    for (i=1; i < grid.ntasks; i++)
+        worker_wait(&tasks[i].worker);
+
+    MemoryBarrier();
+    if (collision_worker.die_please)
+        goto done;
+    for (i=0; i < grid.ntasks; i++)
+        if (tasks[i].failed)
+            goto fail;
+
+    /* Merge each task's collisions into routes' paths. Each collision becomes a conflict zone shared by both routes.
+     * Each path node's collisions are contiguous in airport.collisions, so first count them and point each node at
+     * the end of its share, then fill its share backwards in merge order. */
+merge:
+    for (i=0, j=0; i <= MAX_COLLISION_THREADS; i++)
+    {
+        j += tasks[i].nhits;
+        for (k=0; k < tasks[i].nhits; k++)
+        {
+            hit_t *hit = tasks[i].hits + k;
+            grid.routes[hit->route]->path[hit->node].ncollisions++;
+            grid.routes[hit->other]->path[hit->othernode].ncollisions++;
+        }
+    }
+    if (!(zone = airport.zones = calloc(j+1, sizeof(zone_t))) ||
+        !(newc = airport.collisions = malloc((2*j+1) * sizeof(collision_t))))
+        goto fail;
+    for (i=0; i<nroutes; i++)
+        for (route = grid.routes[i], k=0; k < route->pathlen; k++)
+            route->path[k].collisions = (newc += route->path[k].ncollisions);
+    for (;;)
+    {
+        collision_task_t *task = NULL;
+        route_t *other;
+        hit_t *hit;
+
+        for (i=0; i <= MAX_COLLISION_THREADS; i++)
+            if (tasks[i].merged < tasks[i].nhits &&
+                (!task || sorthit(tasks[i].hits + tasks[i].merged, task->hits + task->merged) < 0))
+                task = tasks + i;
+        if (!task)
+            break;	/* All merged */
+
+        hit = task->hits + task->merged++;
+        route = grid.routes[hit->route];
+        other = grid.routes[hit->other];
+        p0 = &route->path[hit->node].waypoint;
+        p1 = &route->path[(hit->node+1) % route->pathlen].waypoint;
+        p2 = &other->path[hit->othernode].waypoint;
+        p3 = &other->path[(hit->othernode+1) % other->pathlen].waypoint;
+        newc = --route->path[hit->node].collisions;
+        newc->route = other;
+        newc->zone = zone;
+        newc->node = hit->othernode;
+        newc->at = crossing(p0, p1, p2, p3);
+
+        newc = --other->path[hit->othernode].collisions;
+        newc->route = route;
+        newc->zone = zone++;
+        newc->node = hit->node;
+        newc->at = crossing(p2, p3, p0, p1);
+    }
+    result = -1;
+
+    if (grid.cache_dirty)
+        write_collision_cache(&grid, nroutes, tasks, MAX_COLLISION_THREADS+1);
+
 #ifdef DO_BENCHMARK
     gettimeofday(&t2, NULL);		/* stop */
-    sprintf(buffer, "%d us in activate check collisions", (int) ((t2.tv_sec-t1.tv_sec) * 1000000 + t2.tv_usec - t1.tv_usec));
+    for (i=0, j=0; i<nroutes; i++)
+        if (grid.cached[i] >= 0) j++;
+    sprintf(buffer, "%d us in activate check collisions (%d threads, %d/%d routes cached)", (int) ((t2.tv_sec-t1.tv_sec) * 1000000 + t2.tv_usec - t1.tv_usec), grid.ntasks, j, nroutes);
     xplog(buffer);
 #endif
+
+fail:
+    if (!result) xplog("Out of memory!");
+done:
+    for (i=0; i <= MAX_COLLISION_THREADS; i++)
+        free(tasks[i].hits);
+    free(grid.cached);
+    free(grid.hashes);
+    free(grid.cellsegs);
+    free(grid.cellstart);
+    free(grid.segs);
+    free(grid.routes);
     worker_has_finished(&collision_worker);
     return NULL;
 }
 
 
-/* No longer active - unload any resources */
+/* Determine which cells are in range of the camera. Cells that are already live stay so out to a little further. */
+static cellmask_t cells_in_range(const airport_t *airport, float view_x, float view_y, float view_z)
+{
+    cellmask_t live_cells = 0, cell = 1;
+    float ydist = view_y - airport->cell_y;
+    int i, j;
+
+    for (i=0; i<airport->cells_lat; i++)
+        for (j=0; j<airport->cells_lon; j++, cell <<= 1)
+        {
+            /* Distance to nearest edge of cell, or zero if we're inside it */
+            float x0 = airport->cell_x + j * airport->cell_dx, x1 = x0 + airport->cell_dx;
+            float z0 = airport->cell_z + i * airport->cell_dz, z1 = z0 + airport->cell_dz;	/* cell_dz is -ve */
+            float xdist = fmaxf(fmaxf(x0 - view_x, view_x - x1), 0);
+            float zdist = fmaxf(fmaxf(z1 - view_z, view_z - z0), 0);
+            float range = airport->cell_distance + ((airport->live_cells & cell) ? ACTIVE_HYSTERESIS : 0);
+
+            if (xdist*xdist + ydist*ydist + zdist*zdist <= range*range)
+                live_cells |= cell;
+        }
+
+    return live_cells;
+}
+
+/* Update which cells are in range of the camera. Return non-zero if this has changed. */
+static int update_cells(airport_t *airport, float view_x, float view_y, float view_z)
+{
+    cellmask_t live_cells = cells_in_range(airport, view_x, view_y, view_z);
+
+    if (live_cells == airport->live_cells)
+        return 0;
+
+    airport->live_cells = live_cells;
+    return -1;
+}
+
+
+/* No longer active - hide vehicles immediately. Resources are unloaded over subsequent frames by deactivate2(). */
 void deactivate(airport_t *airport)
 {
     route_t *route;
     int i;
+    char msg[64];
 
     if (airport->state!=active && airport->state!=activating) return;
 
-    activating_route = NULL;		/* Abandon any pending async object load */
-    /* These aren't coded to be resumable ('though they could be) - have to wait */
-    worker_wait(&LOD_worker);
-    worker_wait(&collision_worker);
-
-    for(route=airport->routes; route; route=route->next)
+#ifdef DO_BENCHMARK
+    gettimeofday(&deactivating_elapsed_t1, NULL);	/* start */
+    sprintf(msg, "%d deadlocks broken, %d routes left deadlocked", airport->deadlocks, count_deadlocked());
+    xplog(msg);
+    sprintf(msg, "%d us per frame in drawcallback", drawframes ? drawcumul / drawframes : 0);
+    xplog(msg);
+#else
+    if (airport->deadlocks)
     {
-        XPLMDestroyInstance(route->instance_ref); // nst0022
-        route->instance_ref = NULL;
-        XPLMUnloadObject(route->object.objref);
-        route->object.objref=0;
+        /* Routes that deadlock often probably need their paths or timings looking at */
+        sprintf(msg, "Broke %d deadlocks between routes", airport->deadlocks);
+        xplog(msg);
     }
+#endif
+    airport->deadlocks = 0;
+
+    activating_route = pending_route = NULL;	/* Abandon any pending async object load */
+    airport->loadcount = airport->loadnext = 0;
+    airport->live_cells = 0;
+    worker_stop(&LOD_worker);		/* Any LODs not yet calculated are picked up on next activation */
+    finish_LOD_worker(airport);
+    stop_pose_workers();
+    /* collision_worker isn't coded to be resumable ('though it could be) and only runs once, so let it finish */
+
+    /* Destroying instances and unloading objects is slow, so just park the instances out of sight for now */
+    for(route=airport->routes; route; route=route->next)
+        if (route->instance_ref)
+            parkinstance(route->instance_ref);
+    parkcars();
 
-    /* Unregister per-route DataRefs */
+    /* Unregister per-route DataRefs now in case another airport is about to register them */
     for(i=0; i<dataref_count; i++)
     {
         XPLMUnregisterDataAccessor(ref_datarefs[i]);
@@ -1149,11 +1835,56 @@ void deactivate(airport_t *airport)
     //XPLMUnregisterDrawCallback(drawcallback, xplm_Phase_Modern3D, 0, NULL); // nst0022
     //XPLMUnregisterDrawCallback(drawcallback, XPLM_PHASE, 0, NULL);          // nst0022 2.1, nst0022 2.2
 
-    airport->state=inactive;
+    airport->state=deactivating;
+    deactivating_route = airport->routes;
     last_frame = 0;
 }
 
 
+/* Continue going inactive - destroy instances and unload objects, spending at most budget [us] (0 = no limit) in this call */
+void deactivate2(airport_t *airport, int budget)
+{
+    long long t1 = clock_us();
+
+    if (airport->state!=deactivating) return;
+
+    dropcars(NULL);	/* Only as many as were in draw range, so not worth spreading out */
+    while (deactivating_route)
+    {
+        if (budget && clock_us() - t1 >= budget)
+            return;	/* Resume next frame */
+
+        if (deactivating_route->instance_ref)
+        {
+            XPLMDestroyInstance(deactivating_route->instance_ref); // nst0022
+            deactivating_route->instance_ref = NULL;
+        }
+        if (deactivating_route->object.objref)
+        {
+            XPLMUnloadObject(deactivating_route->object.objref);
+            deactivating_route->object.objref = 0;
+        }
+        deactivating_route = deactivating_route->next;
+    }
+
+    if (!budget)
+        worker_wait(&collision_worker);
+    else if (!worker_is_finished(&collision_worker))
+        return;	/* Still working on our first activation */
+
+#ifdef DO_BENCHMARK
+    {
+        struct timeval t2;
+        char msg[64];
+        gettimeofday(&t2, NULL);		/* stop */
+        sprintf(msg, "%d us in deactivate total elapsed", (int) ((t2.tv_sec-deactivating_elapsed_t1.tv_sec) * 1000000 + t2.tv_usec - deactivating_elapsed_t1.tv_usec));
+        xplog(msg);
+    }
+#endif
+    airport->state=inactive;
+}
+
+
 /* Probe out route paths */
 void proberoutes(airport_t *airport)
 {
@@ -1220,6 +1951,20 @@ void proberoutes(airport_t *airport)
     maproutes(airport);
 }
 
+/* Determine OpenGL co-ordinates of the cell grid */
+void mapcells(airport_t *airport)
+{
+    double x0, y0, z0, x1, z1, foo;
+
+    XPLMWorldToLocal(airport->bbox.minlat, airport->bbox.minlon, airport->tower.alt, &x0, &y0, &z0);
+    XPLMWorldToLocal(airport->bbox.maxlat, airport->bbox.maxlon, airport->tower.alt, &x1, &foo, &z1);
+    airport->cell_x  = x0;
+    airport->cell_y  = y0;
+    airport->cell_z  = z0;
+    airport->cell_dx = (x1 - x0) / airport->cells_lon;
+    airport->cell_dz = (z1 - z0) / airport->cells_lat;
+}
+
 /* Determine OpenGL co-ordinates of route paths */
 void maproutes(airport_t *airport)
 {
@@ -1230,6 +1975,9 @@ void maproutes(airport_t *airport)
     gettimeofday(&t1, NULL);		/* start */
 #endif
 
+    mapcells(airport);
+    airport->lookahead = 0;
+
     while (route)
     {
         route->next_y = INVALID_ALT;	/* Need to (re)calculate altitude */
@@ -1249,6 +1997,22 @@ void maproutes(airport_t *airport)
                 path->p.x=x;  path->p.y=y;  path->p.z=z;
             }
 
+            /* Segment geometry, so that it doesn't need recalculating each time a vehicle reaches a node */
+            for (i=0; i<route->pathlen; i++)
+            {
+                path_t *this = route->path + i;
+                path_t *next = route->path + (i+1) % route->pathlen;
+                float dx = next->p.x - this->p.x, dz = next->p.z - this->p.z;
+
+                this->length = sqrtf(dx * dx + dz * dz);
+                this->heading = R2D(atan2f(dx, -dz));
+                this->dx = this->length ? dx / this->length : 0;	/* Last node of a reversible route may be first */
+                this->dz = this->length ? dz / this->length : 0;
+                this->cumul = i ? this[-1].cumul + this[-1].length : 0;
+                if (!route->highway && this->length / route->speed + TURN_TIME > airport->lookahead)
+                    airport->lookahead = this->length / route->speed + TURN_TIME;
+            }
+
             /* Now do bezier turn points */
             for (i = reversible; i < route->pathlen - reversible; i++)
             {
@@ -37,12 +37,16 @@
 
 #if IBM		/* http://msdn.microsoft.com/en-us/library/windows/desktop/ms686355%28v=vs.85%29.aspx */
 #  define WIN32_LEAN_AND_MEAN
+#  ifndef _WIN32_WINNT
+#    define _WIN32_WINNT 0x0600	/* Vista or later, for condition variables */
+#  endif
 #  include <windows.h>
 #else
 #  include <dirent.h>
 #  include <libgen.h>
 #  include <sys/time.h>
 #  include <pthread.h>
+#  include <unistd.h>
 #  if APL	/* https://developer.apple.com/library/mac/documentation/cocoa/Conceptual/Multithreading/ThreadSafety/ThreadSafety.html */
 #    include <libkern/OSAtomic.h>
 #    define MemoryBarrier OSMemoryBarrier
@@ -73,6 +77,8 @@
 #include "XPLMInstance.h"  // nst0022
 
 #include "bbox.h"
+#include "intersect.h"
+#include "bezier.h"
 
 /* Version of assert that suppresses "variable ... set but not used" if the variable only exists for the purpose of the asserted expression */
 #ifdef NDEBUG
@@ -92,6 +98,17 @@
 #define ACTIVE_WATER 20000.f	/* As above when "water" flag is set (you can see a long way on water) */
 #define ACTIVE_HYSTERESIS (ACTIVE_DISTANCE*0.05f)
 #define MAX_RADIUS 4000.f	/* Arbitrary limit on size of routes' bounding box */
+#define MAX_CELLS 8		/* Max number of cells in each direction that routes are divided into for activation */
+#define CELL_SIZE 1000.f	/* Minimum size [m] of a cell */
+#define MAX_COLLISION_CELLS 256	/* Max number of cells in each direction for finding potential collisions */
+#define MAX_COLLISION_THREADS 16	/* Max number of threads for finding potential collisions */
+#define MAX_POSE_THREADS 8	/* Max number of threads, including the main thread, for working out where to draw routes */
+#define POSE_ROUTES_PER_THREAD 2048	/* Fewer routes than this per thread aren't worth the cost of waking it */
+#define POSE_CHUNK 256		/* Number of routes handed to a pose thread at a time. Multiple of 4 for bez4() */
+#define COLLISION_TASK_SEGS 1000	/* Min number of path segments worth starting another thread for */
+#define COLLISION_CACHE "groundtraffic.cache"	/* Collisions found last time, in the package folder */
+#define COLLISION_CACHE_MAGIC "GTcc"
+#define COLLISION_CACHE_VERSION 1
 #define RADIUS 6378145.f	/* from sim/physics/earth_radius_m [m] */
 #define DEFAULT_DRAWLOD 2.f	/* Equivalent to an object 3m high */
 #define DEFAULT_LOD 2.25f	/* Equivalent to "medium" world detail distance */
@@ -103,12 +120,22 @@
 #define TURN_TIME 2.f		/* Time [s] to execute a turn at a waypoint */
 #define AT_INTERVAL 60.f	/* How often [s] to poll for At times */
 #define WHEN_INTERVAL 1.f	/* How often [s] to poll for When DataRef values */
-#define COLLISION_INTERVAL 2.f	/* How long [s] to poll for crossing route path to become free. Also minimum spacing on overlapping segments */
-#define COLLISION_TIMEOUT ((int) 60/COLLISION_INTERVAL)	/* How many times to poll before giving up to break deadlock */
+#define COLLISION_INTERVAL 2.f	/* How long [s] to poll for a plane to get out of the way, or for collisions to be calculated */
 #define COLLISION_ALT 3.f	/* Objects won't collide if their altitude differs by more than this [m] */
-#define RESET_TIME 15.f		/* If we're deactivated for longer than this then reset route timings */
+#define COLLISION_CLEARANCE 10.f	/* Distance [m] a route travels beyond a conflict zone before releasing it */
+#define TRAIL_STEP 1.f		/* Min distance [m] between the points that a train's head records for its cars to follow */
+#define MAX_RESERVED 8		/* Max number of path segments on which a route can hold conflict zones */
+#define RESET_TIME 15.f		/* If time jumps by more than this then seek routes along their timelines, or reset their timings */
+#define ACTIVATE_BUDGET 2000	/* Time [us] per frame to spend finding routes to load or unload as cells come into or go out of range */
+#define DEACTIVATE_BUDGET 2000	/* Time [us] per frame to spend destroying instances and unloading objects while going inactive */
+#define HIDE_DEPTH 10000.f	/* Distance [m] below the OpenGL origin to park instances that are awaiting destruction or re-use */
+#define TIER_MARGIN 10.f	/* Allowance [m] for error in estimating a route's distance from the view */
+#define TIER_SLOW 2.f		/* Routes within this multiple of their draw distance are updated every TIER_SLOW_FRAMES */
+#define TIER_SLOW_FRAMES 8	/* so that their altitude probes are current by the time they come into range */
+#define LOAD_RESORT_DISTANCE 250.f	/* Distance [m] the view has to move while loading before we re-prioritize loads */
 #define MAX_VAR 10		/* How many var datarefs */
 #define HIGHWAY_VARIANCE 0.25f	/* How much to vary spacing of objects on a highway */
+#define HIGHWAY_POOL 64		/* Initial number of routes in the pool for drawing highway cars */
 
 /* Options */
 #undef  DO_BENCHMARK
@@ -233,6 +260,10 @@ typedef struct
     loc_t waypoint;		/* World */
     point_t p;			/* Local OpenGL co-ordinates */
     point_t p1, p3;		/* Bezier points for turn */
+    float length;		/* Length of the segment from here to the next node [m] */
+    float heading;		/* Heading of the segment from here to the next node [degrees] */
+    float dx, dz;		/* Unit vector along the segment, i.e. sin and -cos of heading */
+    float cumul;		/* Distance along the path from the first node to here [m] */
     int pausetime;
     short attime[MAX_ATTIMES];	/* minutes past midnight */
     unsigned char atdays;
@@ -240,7 +271,8 @@ typedef struct
         int reverse : 1;	/* Reverse whole route */
         int backup : 1;		/* Just reverse to next node */
     } flags;
-    struct collision_t *collisions;	/* Collisions with other routes */
+    struct collision_t *collisions;	/* Collisions with other routes - this node's share of airport.collisions */
+    int ncollisions;
     setcmd_t *setcmds;
     whenref_t *whenrefs;
     int drawX, drawY;		/* For labeling nodes */
@@ -262,19 +294,48 @@ typedef struct
     float heading;		/* rotation applied before drawing */
 } objdef_t;
 
+/* Set of cells, one bit per cell */
+typedef unsigned long long cellmask_t;
+
+/* Path segment on which a route holds conflict zones */
+typedef struct
+{
+    int node;		/* Segment runs from this node to the next */
+    int direction;	/* Direction in which we're traversing it */
+    float start;	/* Odometer reading at the segment's first node in our direction of travel [m] */
+    float length;	/* [m] */
+} reservation_t;
+
+/* Arrival at a waypoint on a route's timeline - see maketimelines() */
+typedef struct
+{
+    float arrive, depart;	/* Time since the start of the cycle that we reach the waypoint, and leave after any pause [s] */
+    float distance;		/* Cumulative distance travelled at the waypoint, as route_t.last_distance [m] */
+} leg_t;
+
+/* Where the head of a train was, for the rest of its train to follow. Pose is before the head's object offset and heading */
+typedef struct
+{
+    float odometer;		/* Distance that the head had travelled along its trail [m] */
+    float x, y, z, heading;
+    float dx, dz;		/* Unit vector along heading */
+    float pitch;		/* As for an object with heading 0 */
+    float steer;
+    float distance, last_distance, next_distance;	/* As the head's route_t, for the cars' DataRefs */
+    short last_node, next_node;
+    int backingup;
+} trail_t;
+
 /* A route from routes.txt */
 struct collision_t;
 struct highway_t;
 typedef struct route_t
 {
-    int lineno;			/* Source line in GroundTraffic.txt */
-    objdef_t object;
-    path_t *path;
-    int pathlen;
-    bbox_t bbox;		/* Bounding box of path */
+    /* State read or updated every frame by drawcallback(), kept together at the start for locality */
+    int ready;			/* Objects for this route and the rest of its train are loaded */
     struct
     {
-        int frozen : 1;		/* Child whose parent is waiting */
+        int frozen : 1;		/* Child whose parent is stopped */
         int paused : 1;		/* Waiting for pause duration */
         int waiting : 1;	/* Waiting for At time */
         int dataref : 1;	/* Waiting for DataRef value */
@@ -283,28 +344,54 @@ typedef struct route_t
         int forwardsa : 1;	/* Waypoint after backing up */
         struct collision_t *collision;	/* Waiting for this collision to resolve */
     } state;
+    float last_time, next_time;	/* Time we left last_node, expected time to hit the next node */
     int direction;		/* Traversing path 1=forwards, -1=reverse */
     int last_node, next_node;	/* The last and next waypoints visited on the path */
-    float last_time, next_time;	/* Time we left last_node, expected time to hit the next node */
-    float freeze_time;		/* For children: Time when parent started pause */
+    path_t *path;
+    int pathlen;
     float speed;		/* [m/s] */
     float last_distance;	/* Cumulative distance travelled from first to last_node [m] */
     float next_distance;	/* Distance from last_node to next_node [m] */
     float distance;		/* Cumulative distance travelled from first node [m] */
+    float last_heading;		/* Heading of the previous path segment, for carrying on past a backup waypoint */
     float next_heading;		/* Heading from last_node to next_node [m] */
+    float next_dx, next_dz;	/* Unit vector from last_node to next_node, i.e. sin and -cos of next_heading */
     float steer;		/* Approximate steer angle (degrees) while turning */
-    glColor3f_t drawcolor;	/* debug path color */
-    int drawX, drawY;		/* debug label position */
-    XPLMDrawInfo_t *drawinfo;	/* Where to draw - current OpenGL co-ordinates */
+    int posed;			/* Whether we're close enough to the view to work out where to draw us this frame */
+    float posed_at;		/* Time at which we last worked out where to draw us */
+    float pose_now, pose_progress;	/* Time and progress along the path segment at which to draw us this frame */
     float last_probe, next_probe;	/* Time of last altitude probe and when we should probe again */
     float last_y, next_y;	/* OpenGL co-ordinates at last and next probe points */
-    int deadlocked;		/* Counter used to break collision deadlock */
-    float highway_offset;	/* For highway children: Starting offset from start of route */
-    struct highway_t *highway;	/* Is a highway */
-    userref_t (*varrefs)[MAX_VAR];	/* Per-route var dataref */
+    float odometer, last_odometer;	/* Distance travelled, now and at last_node. For releasing conflict zones [m] */
+    float release_at;		/* Odometer reading at which the next held conflict zone is released [m] */
+    int nreserved;
+    XPLMDrawInfo_t *drawinfo;	/* Where to draw - current OpenGL co-ordinates */
     struct route_t *parent;	/* Points to head of a train */
-    struct route_t *next;
+    trail_t *trail;		/* For heads of trains: Ring buffer of where we've been, for the cars to follow */
+    int trailsize, trailcount, trailend;	/* Allocated, valid and newest entries. Empty after a discontinuity */
+    int trailpoint;		/* For trains' cars: Entry in the head's trail that we were last found to be just ahead of */
+    struct highway_t *highway;	/* Is a highway */
+    objdef_t object;
     XPLMInstanceRef *instance_ref; // nst0022
+    struct route_t *next;
+
+    /* State used when changing path segment, or less often */
+    int deadlocked;		/* Released from a deadlock, so go regardless of other routes at next check */
+    leg_t *timeline;		/* One cycle of the route, nlegs+1 entries. NULL if its timing depends on the sim */
+    int nlegs;
+    float timeline_start;	/* Time at which the current cycle started, going by when we last set off on time */
+    float trainlength;		/* Distance from head to tail of train [m] */
+    reservation_t reserved[MAX_RESERVED];	/* Segments on which we hold conflict zones, oldest first */
+    struct route_t *waiters;	/* Routes waiting for us to release a conflict zone or to load */
+    struct route_t *nextwaiter;	/* Next route in the list of routes waiting for the same route as us */
+    cellmask_t cells;		/* Cells that the route path passes through */
+    float highway_offset;	/* For highway cars: Distance along the path ahead of the highway's flow [m] */
+    int highway_car;		/* For highway cars: Which of the highway's virtual cars we're drawing */
+    bbox_t bbox;		/* Bounding box of path */
+    userref_t (*varrefs)[MAX_VAR];	/* Per-route var dataref */
+    glColor3f_t drawcolor;	/* debug path color */
+    int drawX, drawY;		/* debug label position */
+    int lineno;			/* Source line in GroundTraffic.txt */
 } route_t;
 
 
@@ -318,45 +405,142 @@ typedef struct train_t
 } train_t;
 
 
-/* A highway */
+/* A highway. Its cars don't stop, so rather than each following the path they keep station along it with the flow.
+ * The cars are virtual - a car only takes a route from airport_t's pool of cars while it might be within draw range.
+ * The highway's route and its children just hold the physical objects. */
 #define MAX_HIGHWAY 16
+#define MAX_HIGHWAY_SPANS 8	/* Max number of separate stretches of a highway within draw range */
 typedef struct highway_t
 {
     objdef_t objects[MAX_HIGHWAY];
     objdef_t *expanded;	/* Physical objects */
     int obj_count;	/* Physical object count */
-    float spacing;
+    float spacing;	/* [m]. Adjusted for the number of cars that the user wants on first activation */
+    int ncars;		/* Number of virtual cars */
+    unsigned int seed;	/* Determines each car's object and variation in spacing */
+    struct route_t **holders;	/* Route holding each physical object. The first is the highway's route */
+    unsigned char *drawn;	/* Bitmap of the cars that have a route from the pool */
+    float flow;		/* Distance that the traffic has moved along the path, modulo the path's length [m] */
+    float flow_time;	/* Time at which flow was last advanced */
+    int nspans;
+    float spans[MAX_HIGHWAY_SPANS][2];	/* Stretches of the path within draw range this frame, from its start [m] */
     struct highway_t *next;
 } highway_t;
 
 
-/* Collision between routes */
+/* Conflict zone where two routes' paths cross, which only one of them may occupy at a time.
+ * A route reserves the zones on a path segment as it sets off along it, and releases each once it and the rest of
+ * its train are COLLISION_CLEARANCE beyond it. */
+typedef struct
+{
+    route_t *holder;	/* Route that has reserved the zone, or NULL if free */
+} zone_t;
+
+/* Collision between routes. Stored in one array per airport, grouped by the path node at the start of our segment */
 typedef struct collision_t
 {
     route_t *route;	/* Other route */
+    zone_t *zone;	/* Shared with the other route's collision */
     int node;		/* Other node (assuming forwards direction) */
-    struct collision_t *next;
+    float at;		/* Where the zone lies along our path segment, as a fraction of its length (assuming forwards direction) */
 } collision_t;
 
+/* Path segment, for finding potential collisions */
+typedef struct
+{
+    int route;		/* Index into array of routes */
+    int node;		/* Segment runs from this node to the next */
+    bbox_t bbox;
+} segment_t;
+
+/* Collision found between path segments, before being added to routes' paths */
+typedef struct
+{
+    int route, node;	/* Earlier route in airport.routes */
+    int other, othernode;
+} hit_t;
+
+/* Grid of cells containing path segments, for finding potential collisions */
+typedef struct
+{
+    route_t **routes;	/* Routes that can collide */
+    segment_t *segs;
+    int *cellsegs;	/* Indices into segs, grouped by cell */
+    int *cellstart;	/* Index into cellsegs of each cell's first segment */
+    bbox_t bounds;
+    float dlat, dlon;	/* Size of each cell */
+    int cells_lat, cells_lon;
+    int ntasks;		/* Number of threads sharing out the cells */
+    unsigned long long *hashes;	/* Hash of each route's geometry */
+    int *cached;	/* Each route's index in the collision cache, or -ve if its collisions need calculating */
+    int cache_dirty;	/* Collision cache needs updating */
+} collision_grid_t;
+
+
+/* Entry in the queue of routes whose objects need loading */
+typedef struct
+{
+    route_t *route;
+    float priority;		/* Lower is sooner */
+} loadqueue_t;
+
+/* Route that's turning this frame. Its pose is evaluated by bez4() once every route has been updated */
+typedef struct
+{
+    route_t *route;
+    float steer_sign, steer_base;	/* route->steer = steer_sign * heading + steer_base */
+} turn_t;
+
+/* Turns queued by one thread, in its share of airport_t's turns and beziers */
+typedef struct
+{
+    turn_t *turns;
+    bez4_t *beziers;
+    int nturns;
+} turnqueue_t;
+
 
 /* airport info from routes.txt */
 typedef struct
 {
-    enum { noconfig=0, inactive, activating, active } state;
+    enum { noconfig=0, inactive, activating, active, deactivating } state;
     int case_folding;		/* Whether our package is on a case-sensitive file system (i.e. Linux) */
     int done_first_activation;	/* Whether we've calculated collisions and expanded highways */
+    int done_collisions;	/* Whether calculation of collisions has completed */
     int new_airport;		/* Whether we've moved to a new airport, so activation should be immediate */
     dloc_t tower;
     dpoint_t p;			/* Remember OpenGL location of tower to detect scenery shift */
     int drawroutes;
     int reflections;
+    int maxthreads;		/* Most threads to use for finding collisions, from the "threads" statement. 0 = no limit */
     float active_distance;
+    bbox_t bbox;		/* Bounding box of all routes */
+    int cells_lat, cells_lon;	/* Number of cells in each direction */
+    float cell_distance;	/* Distance [m] from a cell at which to activate its routes */
+    float cell_x, cell_y, cell_z, cell_dx, cell_dz;	/* OpenGL co-ordinates of SW corner of cell grid, and size of each cell */
+    float lookahead;		/* Longest time [s] that a route takes along a path segment, i.e. how far ahead it looks for planes */
+    cellmask_t live_cells;	/* Cells that are currently in range */
+    loadqueue_t *loadqueue;	/* Routes whose objects need loading, in priority order */
+    int loadcount, loadnext;	/* Number of entries in loadqueue, and next entry to load */
+    float load_x, load_z;	/* View position when loadqueue was last prioritized */
+    collision_t *collisions;	/* Collisions between routes, pointed into by routes' path nodes */
+    zone_t *zones;		/* Conflict zones between routes */
+    int deadlocks;		/* Number of deadlocks between routes that we've broken */
     route_t *routes;
     route_t *firstroute;
+    route_t *routetbl;		/* Routes in the order of the routes list once sorted, so that it's contiguous in memory */
+    int nroutes;		/* Number of routes in routetbl */
+    int nleaders;		/* Number of routes in routetbl that aren't children. Children sort after them */
     train_t *trains;
     userref_t *userrefs;
     extref_t *extrefs;
     XPLMDrawInfo_t *drawinfo;	/* consolidated XPLMDrawInfo_t array for all routes/objects so they can be batched */
+    route_t *cars;		/* Pool of routes for drawing highway cars. Not ready if free */
+    XPLMDrawInfo_t *cardrawinfo;	/* and their XPLMDrawInfo_t entries */
+    int ncars, maxcars;		/* Number of routes in the pool that have been used, and allocated */
+    turn_t *turns;		/* Routes that are turning this frame */
+    bez4_t *beziers;		/* and their Bezier curves, four to an entry */
+    leg_t *legs;		/* Routes' timelines */
 } airport_t;
 
 
@@ -377,21 +561,59 @@ typedef struct __attribute__((aligned(64)))
     int finished;
 } worker_t;
 
+/* Lock and condition variable for handing work to worker threads */
+typedef struct
+{
+#if IBM
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cond;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+} signal_t;
+
+/* Thread finding potential collisions in a share of collision_grid_t's cells */
+typedef struct
+{
+    worker_t worker;
+    const collision_grid_t *grid;
+    int first;		/* First cell. Subsequent cells are every grid->ntasks'th */
+    hit_t *hits;	/* Collisions found, sorted */
+    int nhits, maxhits;
+    int merged;		/* Number of hits merged into routes' paths */
+    int failed;		/* Out of memory */
+} collision_task_t;
+
 
 /* prototypes */
 int activate(airport_t *airport);
 void deactivate(airport_t *airport);
+void deactivate2(airport_t *airport, int budget);
 void proberoutes(airport_t *airport);
+void mapcells(airport_t *airport);
 void maproutes(airport_t *airport);
 float userrefcallback(XPLMDataRef inRefcon);
 
 int xplog(char *msg);
 int readconfig(char *pkgpath, airport_t *airport);
 void clearconfig(airport_t *airport);
+int read_collision_cache(collision_grid_t *grid, int nroutes, collision_task_t *restored);
+void write_collision_cache(const collision_grid_t *grid, int nroutes, const collision_task_t *tasks, int ntasks);
 
 void labelcallback(XPLMWindowID inWindowID, void *inRefcon);
 //int drawcallback(XPLMDrawingPhase inPhase, int inIsBefore, void *inRefcon); // nst0022 2.2
 int drawcallback();                                                           // nst0022 2.2
+void release_zones(route_t *route, int all);
+void wake_waiters(route_t *route);
+#ifdef DO_BENCHMARK
+int count_deadlocked(void);
+#endif
+int start_pose_workers(void);
+void stop_pose_workers(void);
+void parkinstance(XPLMInstanceRef instance_ref);
+void parkcars(void);
+void dropcars(XPLMObjectRef objref);
 
 void drawdebug3d(int drawnodes, GLint view[4]);
 void drawdebug2d();
@@ -404,6 +626,7 @@ void get_dataref_values(const route_t *route, float *dataref_values);
 extern char *pkgpath;
 extern XPLMDataRef ref_plane_lat, ref_plane_lon, ref_view_x, ref_view_y, ref_view_z, ref_rentype, ref_night, ref_monotonic, ref_doy, ref_tod, ref_LOD;
 extern XPLMDataRef ref_datarefs[dataref_count], ref_varref;
+extern const char *datarefs[];
 extern XPLMProbeRef ref_probe;
 extern float lod_bias;
 extern airport_t airport;
@@ -446,6 +669,73 @@ static inline int indrawrange(float xdist, float ydist, float zdist, float range
     return (xdist*xdist + ydist*ydist + zdist*zdist <= range*range);
 }
 
+/* Index of the cell row / column containing a latitude / longitude */
+static inline int celllat(const airport_t *airport, float lat)
+{
+    int i = airport->bbox.maxlat > airport->bbox.minlat ? (int) ((lat - airport->bbox.minlat) * airport->cells_lat / (airport->bbox.maxlat - airport->bbox.minlat)) : 0;
+    return i < 0 ? 0 : (i >= airport->cells_lat ? airport->cells_lat-1 : i);
+}
+
+static inline int celllon(const airport_t *airport, float lon)
+{
+    int i = airport->bbox.maxlon > airport->bbox.minlon ? (int) ((lon - airport->bbox.minlon) * airport->cells_lon / (airport->bbox.maxlon - airport->bbox.minlon)) : 0;
+    return i < 0 ? 0 : (i >= airport->cells_lon ? airport->cells_lon-1 : i);
+}
+
+/* Is the route in a cell that's currently in range? */
+static inline int route_live(const airport_t *airport, const route_t *route)
+{
+    return (route->cells & airport->live_cells) != 0;
+}
+
+/* Waypoint at which a leg of the route's timeline starts, and the direction in which we set off from it */
+static inline int leg_node(const route_t *route, int leg, int *direction)
+{
+    *direction = (leg < route->pathlen-1 || !route->path[route->pathlen-1].flags.reverse) ? 1 : -1;
+    return leg < route->pathlen ? leg : 2 * (route->pathlen-1) - leg;
+}
+
+/* Leg of the route's timeline that we're on, i.e. the one that starts at last_node */
+static inline int route_leg(const route_t *route)
+{
+    return route->direction > 0 ? route->last_node : 2 * (route->pathlen-1) - route->last_node;
+}
+
+/* Operations on the graph of routes waiting for each other's conflict zones */
+
+/* Route that this route is waiting for to release a conflict zone, or NULL */
+static inline route_t *waitingfor(const route_t *route, const collision_t *c)
+{
+    return (c && c != (collision_t*) -1 && c->zone->holder == c->route) ? c->route : NULL;
+}
+
+
+/* We're about to wait for other to release a conflict zone. Follow the chain of routes that are waiting on each
+ * other, and if it leads back to us then we have a deadlock. Each route waits for at most one other, so the chain
+ * either ends at a route that isn't waiting for a conflict zone, loops back to us, or runs into a cycle that doesn't
+ * include us. The last happens while a cycle's victim has yet to move on - that cycle is already being broken, so it
+ * isn't a new deadlock. We detect that by following the chain a second time at half speed - if the two meet before
+ * we get back to ourselves then the chain has looped without us.
+ * Returns the route in the cycle with the lowest line number, so that the choice of which route to release doesn't
+ * depend on which route happened to close the cycle. Returns NULL if no new deadlock. */
+static inline route_t *deadlock(route_t *route, route_t *other)
+{
+    route_t *victim = route, *slow = other;
+    int steps;
+
+    for (steps = 0; other != route; other = waitingfor(other, other->state.collision))
+    {
+        if (!other || (steps && other == slow))
+            return NULL;	/* Chain ends at a route that's free to move on, or at someone else's cycle */
+        if (other->lineno < victim->lineno)
+            victim = other;
+        if (!(++steps & 1))
+            slow = waitingfor(slow, slow->state.collision);
+    }
+    return victim;
+}
+
+
 static inline float R2D(float r)
 {
     return r * ((float) (180*M_1_PI));
@@ -516,6 +806,25 @@ static inline int loc_intersect(loc_t *p0, loc_t *p1, loc_t *p2, loc_t *p3)
 }
 
 
+/* Wall-clock time [us] for budgeting work across frames - unrelated to sim time */
+static inline long long clock_us()
+{
+#if IBM
+    LARGE_INTEGER frequency;        // ticks per second
+    LARGE_INTEGER counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (counter.QuadPart / frequency.QuadPart) * 1000000 + ((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+
 /* quick and dirty and not very accurate gettimeofday implementation ignoring timezone */
 #if defined(_MSC_VER) && defined(DO_BENCHMARK)
 # include <winsock2.h>	/* for timeval */
@@ -536,14 +845,14 @@ static inline int gettimeofday(struct timeval *tp, void *tzp)
 
 /* Operations on worker_t */
 
-static inline int worker_start(worker_t *worker, void *(*start_routine)(void *))
+static inline int worker_start(worker_t *worker, void *(*start_routine)(void *), void *arg)
 {
     worker->die_please = worker->finished = 0;
     MemoryBarrier();
 #if IBM
-    if (!(worker->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) start_routine, NULL, 0, NULL)))
+    if (!(worker->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) start_routine, arg, 0, NULL)))
 #else
-    if (pthread_create(&worker->thread, NULL, start_routine, NULL))
+    if (pthread_create(&worker->thread, NULL, start_routine, arg))
 #endif
     {
         return xplog("Internal error: Can't create worker thread");
@@ -551,6 +860,18 @@ static inline int worker_start(worker_t *worker, void *(*start_routine)(void *))
     return -1;
 }
 
+/* Number of processors available for worker threads */
+static inline int cpu_count()
+{
+#if IBM
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
 /* Wait for worker to stop */
 static inline void worker_wait(worker_t *worker)
 {
@@ -602,4 +923,66 @@ static inline int worker_is_finished(worker_t *worker)
 #define worker_has_finished(worker) { MemoryBarrier(); (*(worker)).finished = -1; }
 
 
+/* Operations on signal_t - a lock, and a condition variable for waking threads waiting on it */
+
+static inline void signal_init(signal_t *signal)
+{
+#if IBM
+    InitializeCriticalSection(&signal->lock);
+    InitializeConditionVariable(&signal->cond);
+#else
+    pthread_mutex_init(&signal->lock, NULL);
+    pthread_cond_init(&signal->cond, NULL);
+#endif
+}
+
+static inline void signal_destroy(signal_t *signal)
+{
+#if IBM
+    DeleteCriticalSection(&signal->lock);
+#else
+    pthread_cond_destroy(&signal->cond);
+    pthread_mutex_destroy(&signal->lock);
+#endif
+}
+
+static inline void signal_lock(signal_t *signal)
+{
+#if IBM
+    EnterCriticalSection(&signal->lock);
+#else
+    pthread_mutex_lock(&signal->lock);
+#endif
+}
+
+static inline void signal_unlock(signal_t *signal)
+{
+#if IBM
+    LeaveCriticalSection(&signal->lock);
+#else
+    pthread_mutex_unlock(&signal->lock);
+#endif
+}
+
+/* Release the lock and wait to be woken. Callers must re-check their condition since wakeups can be spurious */
+static inline void signal_wait(signal_t *signal)
+{
+#if IBM
+    SleepConditionVariableCS(&signal->cond, &signal->lock, INFINITE);
+#else
+    pthread_cond_wait(&signal->cond, &signal->lock);
+#endif
+}
+
+/* Wake all waiting threads. Caller must hold the lock */
+static inline void signal_broadcast(signal_t *signal)
+{
+#if IBM
+    WakeAllConditionVariable(&signal->cond);
+#else
+    pthread_cond_broadcast(&signal->cond);
+#endif
+}
+
+
 #endif /* _GROUNDTRAFFIC_H_ */
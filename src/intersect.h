@@ -0,0 +1,79 @@
+/*
+ * GroundTraffic
+ *
+ * (c) Jonathan Harris 2013
+ *
+ * Licensed under GNU LGPL v2.1.
+ */
+
+#ifndef	_INTERSECT_H_
+#define	_INTERSECT_H_
+
+/* Use SSE only where scalar float arithmetic is also done in SSE registers, so that results are identical to
+ * intersect() and loc_intersect(). 32bit gcc builds do scalar arithmetic at x87 extended precision, and builds for
+ * processors with FMA may fuse the scalar multiplies and adds. Define INTERSECT_SSE=0 to force the scalar version,
+ * e.g. to test it. */
+#ifndef INTERSECT_SSE
+#  if ((defined(__SSE_MATH__) && defined(__SSE2__)) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) && !defined(__FMA__)
+#    define INTERSECT_SSE 1
+#  else
+#    define INTERSECT_SSE 0
+#  endif
+#endif
+#if INTERSECT_SSE
+#  include <emmintrin.h>
+#endif
+
+/* Do s = sn/d and t = tn/d both lie strictly between 0 and 1?
+ * Compared without dividing so that the result doesn't depend on how the compiler chooses to implement division under
+ * -ffast-math, e.g. by multiplying by a reciprocal. intersect() and loc_intersect() do divide, so could differ from this
+ * where s or t is within rounding of 0 or 1 - intersecttest.c checks that they don't, including for lines that touch. */
+static inline int intersect_st(float sn, float tn, float d)
+{
+    if (d < 0)
+    {
+        sn = -sn;  tn = -tn;  d = -d;
+    }
+    return sn > 0 && sn < d && tn > 0 && tn < d;	/* Also false for d==0 i.e. precisely parallel or collinear */
+}
+
+/* 2D does line (x0,y0)->(x1,y1) intersect each of the four lines (x2[i],y2[i])->(x3[i],y3[i]).
+ * Returns a mask with bit i set if line i intersects.
+ * Uses the same products and strict comparisons as intersect() and loc_intersect() - see intersect_st(). */
+static inline int intersect4(float x0, float y0, float x1, float y1, const float x2[4], const float y2[4], const float x3[4], const float y3[4])
+{
+#if INTERSECT_SSE
+    __m128 s1_x = _mm_set1_ps(x1 - x0), s1_y = _mm_set1_ps(y1 - y0);
+    __m128 v2_x = _mm_loadu_ps(x2), v2_y = _mm_loadu_ps(y2);
+    __m128 s2_x = _mm_sub_ps(_mm_loadu_ps(x3), v2_x), s2_y = _mm_sub_ps(_mm_loadu_ps(y3), v2_y);
+    __m128 d_x = _mm_sub_ps(_mm_set1_ps(x0), v2_x), d_y = _mm_sub_ps(_mm_set1_ps(y0), v2_y);
+    __m128 d  = _mm_sub_ps(_mm_mul_ps(s1_x, s2_y), _mm_mul_ps(s2_x, s1_y));
+    __m128 sn = _mm_sub_ps(_mm_mul_ps(s1_x, d_y), _mm_mul_ps(s1_y, d_x));
+    __m128 tn = _mm_sub_ps(_mm_mul_ps(s2_x, d_y), _mm_mul_ps(s2_y, d_x));
+    __m128 sign = _mm_and_ps(d, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));	/* Not -0.f, which -ffast-math may treat as 0 */
+    __m128 zero = _mm_setzero_ps();
+
+    /* Flip signs so that d is positive, as intersect_st() */
+    sn = _mm_xor_ps(sn, sign);
+    tn = _mm_xor_ps(tn, sign);
+    d  = _mm_xor_ps(d,  sign);
+    return _mm_movemask_ps(_mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(sn, zero), _mm_cmplt_ps(sn, d)),
+                                      _mm_and_ps(_mm_cmpgt_ps(tn, zero), _mm_cmplt_ps(tn, d))));
+#else
+    float s1_x, s1_y, s2_x, s2_y;
+    int i, mask = 0;
+
+    s1_x = x1 - x0;  s1_y = y1 - y0;
+    for (i=0; i<4; i++)
+    {
+        s2_x = x3[i] - x2[i];  s2_y = y3[i] - y2[i];
+        if (intersect_st(s1_x * (y0 - y2[i]) - s1_y * (x0 - x2[i]),
+                         s2_x * (y0 - y2[i]) - s2_y * (x0 - x2[i]),
+                         s1_x * s2_y - s2_x * s1_y))
+            mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+#endif /* _INTERSECT_H_ */
@@ -0,0 +1,272 @@
+/*
+ * GroundTraffic
+ *
+ * (c) Jonathan Harris 2013
+ *
+ * Licensed under GNU LGPL v2.1.
+ */
+
+/* Standalone check of intersect4() against the scalar intersect() and loc_intersect() in groundtraffic.h, plus a
+ * microbenchmark of the two. Build and run with "make -f Makefile.lin intersecttest", which tests both the SSE and the
+ * scalar (INTERSECT_SSE=0) versions. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "intersect.h"
+
+#define NRANDOM 1000000		/* Number of random pairs of segments to check */
+#define BOUNDARY 1e-5		/* s or t this close to 0 or 1 is at the mercy of rounding */
+#define BENCH_SEGS 4096		/* Small enough to stay in cache, so we time the arithmetic */
+#define BENCH_PASSES 1000
+
+typedef struct
+{
+    float x, y, z;
+} point_t;
+
+typedef struct
+{
+    float lat, lon;
+} loc_t;
+
+static int failures = 0;
+static long tests = 0, boundary = 0, boundary_differ = 0, scalar_wrong = 0;
+
+
+/* Copies of the scalar versions in groundtraffic.h, which doesn't build outside X-Plane */
+
+/* 2D does line p0->p1 intersect p2->p3 */
+static inline int intersect(point_t *p0, point_t *p1, point_t *p2, point_t *p3)
+{
+    /* http://stackoverflow.com/a/1968345 */
+    float s, t, d, s1_x, s1_z, s2_x, s2_z;
+
+    s1_x = p1->x - p0->x;  s1_z = p1->z - p0->z;
+    s2_x = p3->x - p2->x;  s2_z = p3->z - p2->z;
+    d = -s2_x * s1_z + s1_x * s2_z;
+    if (d==0) return 0;	/* Precisely parallel or collinear - ignore in either case */
+
+    s = (-s1_z * (p0->x - p2->x) + s1_x * (p0->z - p2->z)) / d;
+    t = ( s2_x * (p0->z - p2->z) - s2_z * (p0->x - p2->x)) / d;
+
+    /* use strict comparison because only interested in significant intersections */
+    return s > 0 && s < 1 && t > 0 && t < 1;
+}
+
+/* 2D does line p0->p1 intersect p2->p3 */
+static inline int loc_intersect(loc_t *p0, loc_t *p1, loc_t *p2, loc_t *p3)
+{
+    /* http://stackoverflow.com/a/1968345 */
+    float s, t, d, s1_x, s1_y, s2_x, s2_y;
+
+    s1_x = p1->lon - p0->lon;  s1_y = p1->lat - p0->lat;
+    s2_x = p3->lon - p2->lon;  s2_y = p3->lat - p2->lat;
+    d = (-s2_x * s1_y + s1_x * s2_y);
+    if (d==0) return 0;	/* Precisely parallel or collinear - ignore in either case */
+
+    s = (-s1_y * (p0->lon - p2->lon) + s1_x * (p0->lat - p2->lat)) / d;
+    t = ( s2_x * (p0->lat - p2->lat) - s2_y * (p0->lon - p2->lon)) / d;
+
+    /* use strict comparison because path segments don't count as colliding if they just share a starting node */
+    return s > 0 && s < 1 && t > 0 && t < 1;
+}
+
+
+/* Is s = sn/d within BOUNDARY of 0 or 1, where whether we divide or not decides which side of the end it lands? */
+static int near_end(float sn, float d)
+{
+    double s = (double) sn / (double) d;
+    return fabs(s) < BOUNDARY || fabs(s - 1) < BOUNDARY;
+}
+
+
+/* Check intersect4() against intersect() and loc_intersect() for one line against four. They must agree unless the
+ * lines just touch - intersect() divides, which -ffast-math may do by multiplying by a reciprocal, so its s and t can
+ * land either side of 0 or 1. intersect4() doesn't divide, so if the coordinates are small integers (exact is set) its
+ * arithmetic is exact and it must give the right answer. */
+static void check(const char *what, float x0, float y0, float x1, float y1, const float x2[4], const float y2[4], const float x3[4], const float y3[4], int exact)
+{
+    int mask = intersect4(x0, y0, x1, y1, x2, y2, x3, y3);
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        point_t p0 = { x0, 0, y0 }, p1 = { x1, 0, y1 }, p2 = { x2[i], 0, y2[i] }, p3 = { x3[i], 0, y3[i] };
+        loc_t l0 = { y0, x0 }, l1 = { y1, x1 }, l2 = { y2[i], x2[i] }, l3 = { y3[i], x3[i] };
+        float s1_x = x1 - x0, s1_y = y1 - y0, s2_x = x3[i] - x2[i], s2_y = y3[i] - y2[i];
+        float d  = s1_x * s2_y - s2_x * s1_y;
+        float sn = s1_x * (y0 - y2[i]) - s1_y * (x0 - x2[i]);
+        float tn = s2_x * (y0 - y2[i]) - s2_y * (x0 - x2[i]);
+        int got = (mask >> i) & 1;
+        int scalar = intersect(&p0, &p1, &p2, &p3);
+        int loc = loc_intersect(&l0, &l1, &l2, &l3);
+
+        tests++;
+        if (scalar != loc)
+        {
+            if (++failures <= 10)
+                printf("FAIL %s: intersect() %d and loc_intersect() %d disagree\n", what, scalar, loc);
+        }
+        else if (exact)
+        {
+            /* Exact answer in double, in which these products and differences of small integers can't round */
+            double sx = s1_x, sy = s1_y, tx = s2_x, ty = s2_y, ex = (double) x0 - (double) x2[i], ey = (double) y0 - (double) y2[i];
+            double dd = sx * ty - tx * sy, dsn = sx * ey - sy * ex, dtn = tx * ey - ty * ex;
+            int truth = dd > 0 ? (dsn > 0 && dsn < dd && dtn > 0 && dtn < dd) : (dsn < 0 && dsn > dd && dtn < 0 && dtn > dd);
+
+            if (d != 0 && (near_end(sn, d) || near_end(tn, d)))
+            {
+                boundary++;
+                if (got != scalar) boundary_differ++;
+                if (scalar != truth) scalar_wrong++;
+            }
+            if (got != truth && ++failures <= 10)
+                printf("FAIL %s: (%g,%g)->(%g,%g) vs (%g,%g)->(%g,%g): intersect4 %d, should be %d\n", what,
+                       (double) x0, (double) y0, (double) x1, (double) y1, (double) x2[i], (double) y2[i], (double) x3[i], (double) y3[i], got, truth);
+        }
+        else if (d != 0 && (near_end(sn, d) || near_end(tn, d)))
+        {
+            boundary++;
+            if (got != scalar) boundary_differ++;
+        }
+        else if (got != scalar && ++failures <= 10)
+        {
+            printf("FAIL %s: (%g,%g)->(%g,%g) vs (%g,%g)->(%g,%g): intersect4 %d, intersect %d\n", what,
+                   (double) x0, (double) y0, (double) x1, (double) y1, (double) x2[i], (double) y2[i], (double) x3[i], (double) y3[i], got, scalar);
+        }
+    }
+}
+
+
+/* Every pair of segments between the points of a 5x5 grid, which includes every way that two segments can be
+ * collinear, parallel, touch at their ends or touch one's end to the other's middle, and segments of zero length */
+static void test_degenerate(void)
+{
+    static const float scales[] = { 1, 7, 1024 };
+    float x2[4], y2[4], x3[4], y3[4];
+    int scale, a, b, c, n = 0;
+
+    for (scale = 0; scale < sizeof(scales)/sizeof(scales[0]); scale++)
+        for (a = 0; a < 25; a++)
+            for (b = 0; b < 25; b++)
+                for (c = 0; c < 25 * 25; c++)
+                {
+                    x2[n] = (c / 25 % 5) * scales[scale];  y2[n] = (c / 25 / 5) * scales[scale];
+                    x3[n] = (c % 25 % 5) * scales[scale];  y3[n] = (c % 25 / 5) * scales[scale];
+                    if (++n == 4)
+                    {
+                        check("grid", (a % 5) * scales[scale], (a / 5) * scales[scale], (b % 5) * scales[scale], (b / 5) * scales[scale], x2, y2, x3, y3, 1);
+                        n = 0;
+                    }
+                }
+}
+
+
+static float frand(float lo, float hi)
+{
+    return lo + (hi - lo) * (float) rand() / (float) RAND_MAX;
+}
+
+
+/* Path segments of various lengths anywhere within an airport, in OpenGL co-ordinates and in lat/lon. Most of the
+ * second segments start near the first so that about half of the pairs cross. */
+static void test_random(void)
+{
+    float x2[4], y2[4], x3[4], y3[4];
+    int n, i;
+
+    srand(1);
+    for (n = 0; n < NRANDOM / 4; n++)
+    {
+        float x0 = frand(-5000, 5000), y0 = frand(-5000, 5000), size = frand(0.1f, 500);
+        float x1 = x0 + frand(-size, size), y1 = y0 + frand(-size, size);
+
+        for (i = 0; i < 4; i++)
+        {
+            x2[i] = x0 + frand(-size, size);  y2[i] = y0 + frand(-size, size);
+            x3[i] = x2[i] + frand(-2 * size, 2 * size);  y3[i] = y2[i] + frand(-2 * size, 2 * size);
+        }
+        check("random", x0, y0, x1, y1, x2, y2, x3, y3, 0);
+
+        /* Same shapes around an airport at 47N 122W, in degrees. About 1e-4 of a degree per 10m */
+        for (i = 0; i < 4; i++)
+        {
+            x2[i] = -122 + x2[i] * 1e-5f;  y2[i] = 47 + y2[i] * 1e-5f;
+            x3[i] = -122 + x3[i] * 1e-5f;  y3[i] = 47 + y3[i] * 1e-5f;
+        }
+        check("random lat/lon", -122 + x0 * 1e-5f, 47 + y0 * 1e-5f, -122 + x1 * 1e-5f, 47 + y1 * 1e-5f, x2, y2, x3, y3, 0);
+    }
+}
+
+
+static double elapsed_us(const struct timeval *t1)
+{
+    struct timeval t2;
+    gettimeofday(&t2, NULL);
+    return (t2.tv_sec - t1->tv_sec) * 1e6 + (t2.tv_usec - t1->tv_usec);
+}
+
+
+/* One segment against each of BENCH_SEGS others, as check_collisions() does */
+static void benchmark(void)
+{
+    static point_t p2[BENCH_SEGS], p3[BENCH_SEGS];
+    static float x2[BENCH_SEGS], z2[BENCH_SEGS], x3[BENCH_SEGS], z3[BENCH_SEGS];
+    point_t p0 = { 0, 0, 0 }, p1 = { 100, 0, 30 };
+    static const int bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };	/* core2 has no popcnt */
+    volatile int sink = 0;
+    struct timeval t1;
+    double scalar, batch;
+    int pass, i, hits;
+
+    srand(2);
+    for (i = 0; i < BENCH_SEGS; i++)
+    {
+        p2[i].x = x2[i] = frand(-100, 200);  p2[i].z = z2[i] = frand(-100, 100);
+        p3[i].x = x3[i] = frand(-100, 200);  p3[i].z = z3[i] = frand(-100, 100);
+    }
+
+    gettimeofday(&t1, NULL);
+    for (pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        p0.x = (float) (pass & 1);	/* Stop the compiler from hoisting the work out of the loop */
+        for (hits = i = 0; i < BENCH_SEGS; i++)
+            hits += intersect(&p0, &p1, p2 + i, p3 + i);
+        sink += hits;
+    }
+    scalar = elapsed_us(&t1);
+
+    gettimeofday(&t1, NULL);
+    for (pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        p0.x = (float) (pass & 1);
+        for (hits = i = 0; i < BENCH_SEGS; i += 4)
+            hits += bits[intersect4(p0.x, p0.z, p1.x, p1.z, x2 + i, z2 + i, x3 + i, z3 + i)];
+        sink += hits;
+    }
+    batch = elapsed_us(&t1);
+
+    printf("intersect: %.2f ns/test, intersect4: %.2f ns/test, %.2fx\n",
+           scalar * 1000 / ((double) BENCH_PASSES * BENCH_SEGS), batch * 1000 / ((double) BENCH_PASSES * BENCH_SEGS), scalar / batch);
+    (void) sink;
+}
+
+
+int main(void)
+{
+    printf("intersect4 %s version\n", INTERSECT_SSE ? "SSE" : "scalar");
+    test_degenerate();
+    test_random();
+    printf("%ld tests, %ld touching or nearly: intersect4 differs from intersect on %ld, intersect is wrong on %ld\n",
+           tests, boundary, boundary_differ, scalar_wrong);
+    if (failures)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    benchmark();
+    return 0;
+}
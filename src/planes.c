@@ -11,274 +11,535 @@
 
 /* Globals */
 static const char sep[]=" \t\r\n";
-static int plane_count = 0;
-static plane_ref_t plane_refs[MAX_PLANES] = {0};
-static plane_acf_t plane_info[MAX_PLANES] = {0};
+static plane_ref_t plane_refs = {0};
+static plane_bulk_t plane_pos = {0};		/* Positions of all planes */
+static plane_acf_t *plane_info = NULL;
+static plane_footprint_t *plane_footprints = NULL;
+static int *near_planes = NULL;			/* Index of each plane that's on the ground near the airport */
+static int plane_count = 0;			/* Number of planes this frame */
+static int plane_max = 0;			/* Allocated size of per-plane arrays */
+static int acf_count = 0;			/* Number of planes whose dimensions we know */
+static int tcas_override = 0;			/* Whether a plugin was supplying TCAS targets when we looked up dimensions */
+static int near_count = 0;			/* Number of planes on the ground near the airport this frame */
+static float planes_frame = -1;			/* Value of last_frame when planes were last read */
+static acf_entry_t *acf_cache = NULL;		/* ACF files that we've seen */
+static int acf_cache_count = -1;		/* Number of ACF files that we've seen. -1 = cache not yet read */
+static worker_t acf_worker = { 0 };		/* Reads ACF files in the background */
+static acf_entry_t *acf_jobs = NULL;		/* Copy of ACF files that the worker is reading */
+static int acf_njobs = 0;
 
 /* In this file */
-static void read_v10_plane(FILE *h, int platform, plane_acf_t *info);
-static void read_old_plane(FILE *h, int platform, plane_acf_t *info);
-
+static int grow_planes(int count);
+static void update_planes();
+static void read_plane_info(int count);
+static int find_acf(const char *path, long long size, long long mtime);
+static void start_acf_worker();
+static void finish_acf_worker();
+static void *read_acfs(void *arg);
+static void read_acf(acf_entry_t *entry);
+static void read_v10_plane(const char *buf, const char *end, acf_entry_t *entry);
+static void read_old_plane(const unsigned char *buf, long size, int platform, acf_entry_t *entry);
+static void update_plane_footprint(int planeno);
+
+/* Positions of all planes, including the user's plane and planes injected by traffic plugins, are read in bulk from the
+ * DataRefs that X-Plane presents to TCAS */
 int setup_plane_refs()
 {
-    int i;
-    plane_ref_t *plane_ref;
     char name[64], *c;
 
-    /* User's aircraft */
-    c = name + sprintf(name, "sim/flightmodel/position/");
-    plane_ref = plane_refs + 0;
+    if (!(plane_refs.count = XPLMFindDataRef("sim/cockpit2/tcas/indicators/tcas_num_acf"))) return 0;
 
-    strcpy(c, "local_x");     if (!(plane_ref->x   = XPLMFindDataRef(name))) return 0;
-    strcpy(c, "local_y");     if (!(plane_ref->y   = XPLMFindDataRef(name))) return 0;
-    strcpy(c, "local_z");     if (!(plane_ref->z   = XPLMFindDataRef(name))) return 0;
-    strcpy(c, "local_vx");    if (!(plane_ref->vx  = XPLMFindDataRef(name))) return 0;
-    strcpy(c, "local_vz");    if (!(plane_ref->vz  = XPLMFindDataRef(name))) return 0;
-    strcpy(c, "psi");         if (!(plane_ref->hdg = XPLMFindDataRef(name))) return 0;
-    if (!(plane_ref->gear= XPLMFindDataRef("sim/aircraft/parts/acf_gear_deploy"))) return 0;
-
-    /* AI aircraft */
-    for (i=1; i<MAX_PLANES; i++)
-    {
-        c = name + sprintf(name, "sim/multiplayer/position/plane%d_", i);
-        plane_ref = plane_refs + i;
-
-        strcpy(c, "x");           if (!(plane_ref->x   = XPLMFindDataRef(name))) return 0;
-        strcpy(c, "y");           if (!(plane_ref->y   = XPLMFindDataRef(name))) return 0;
-        strcpy(c, "z");           if (!(plane_ref->z   = XPLMFindDataRef(name))) return 0;
-        strcpy(c, "v_x");         if (!(plane_ref->vx  = XPLMFindDataRef(name))) return 0;
-        strcpy(c, "v_z");         if (!(plane_ref->vz  = XPLMFindDataRef(name))) return 0;
-        strcpy(c, "psi");         if (!(plane_ref->hdg = XPLMFindDataRef(name))) return 0;
-        strcpy(c, "gear_deploy"); if (!(plane_ref->gear= XPLMFindDataRef(name))) return 0;
-    }
+    c = name + sprintf(name, "sim/cockpit2/tcas/targets/position/");
+    strcpy(c, "x");           if (!(plane_refs.x   = XPLMFindDataRef(name))) return 0;
+    strcpy(c, "y");           if (!(plane_refs.y   = XPLMFindDataRef(name))) return 0;
+    strcpy(c, "z");           if (!(plane_refs.z   = XPLMFindDataRef(name))) return 0;
+    strcpy(c, "vx");          if (!(plane_refs.vx  = XPLMFindDataRef(name))) return 0;
+    strcpy(c, "vz");          if (!(plane_refs.vz  = XPLMFindDataRef(name))) return 0;
+    strcpy(c, "psi");         if (!(plane_refs.hdg = XPLMFindDataRef(name))) return 0;
+    strcpy(c, "gear_deploy"); if (!(plane_refs.gear= XPLMFindDataRef(name))) return 0;
+    plane_refs.override = XPLMFindDataRef("sim/operation/override/override_TCAS");	/* Optional */
 
     return -1;
 }
 
+/* Planes have changed, so re-read their dimensions */
 void reset_planes()
 {
-    plane_count = 0;
+    acf_count = 0;
+}
+
+/* Plugin is being disabled */
+void stop_planes()
+{
+    worker_stop(&acf_worker);
+    free(acf_jobs);
+    acf_jobs = NULL;
+    acf_njobs = 0;
 }
 
+/* Number of planes that are on the ground near the airport this frame. Planes are numbered 0 to count-1 */
 int count_planes()
 {
+    if (planes_frame != last_frame) update_planes();
+    return near_count;
+}
+
+
+/* Make room for count planes. Returns 0 if out of memory */
+static int grow_planes(int count)
+{
+    float **arrays[] = { &plane_pos.x, &plane_pos.y, &plane_pos.z, &plane_pos.vx, &plane_pos.vz, &plane_pos.hdg, &plane_pos.gear };
+    void *p;
     int i;
+
+    for (i=0; i < sizeof(arrays)/sizeof(arrays[0]); i++)
+    {
+        if (!(p = realloc(*arrays[i], count * sizeof(float)))) return xplog("Out of memory!");
+        *arrays[i] = p;
+    }
+    if (!(p = realloc(plane_info, count * sizeof(plane_acf_t)))) return xplog("Out of memory!");
+    plane_info = p;
+    if (!(p = realloc(plane_footprints, count * sizeof(plane_footprint_t)))) return xplog("Out of memory!");
+    plane_footprints = p;
+    if (!(p = realloc(near_planes, count * sizeof(int)))) return xplog("Out of memory!");
+    near_planes = p;
+
+    for (i=plane_max; i<count; i++)
+        plane_footprints[i].frame = -1;
+    plane_max = count;
+    return -1;
+}
+
+
+/* Read all planes' positions, and find those that are on the ground near enough to the airport to get in the way */
+static void update_planes()
+{
+    float x0, x1, z0, z1;
+    int i, n;
+
+    planes_frame = last_frame;
+    if (acf_jobs && worker_is_finished(&acf_worker)) finish_acf_worker();
+    n = XPLMGetDatai(plane_refs.count);
+    i = XPLMGetDatavf(plane_refs.x, NULL, 0, 0);	/* Number of planes that X-Plane has room for */
+    if (n > i) n = i;
+    if (n > plane_max && !grow_planes(n)) n = plane_max;
+    if (plane_refs.override && XPLMGetDatai(plane_refs.override) != tcas_override) acf_count = 0;	/* Planes have changed */
+    if (n > acf_count) read_plane_info(n);
+    plane_count = n;
+    near_count = 0;
+    if (n <= 0) return;
+
+    XPLMGetDatavf(plane_refs.x,    plane_pos.x,    0, n);
+    XPLMGetDatavf(plane_refs.y,    plane_pos.y,    0, n);
+    XPLMGetDatavf(plane_refs.z,    plane_pos.z,    0, n);
+    XPLMGetDatavf(plane_refs.vx,   plane_pos.vx,   0, n);
+    XPLMGetDatavf(plane_refs.vz,   plane_pos.vz,   0, n);
+    XPLMGetDatavf(plane_refs.hdg,  plane_pos.hdg,  0, n);
+    XPLMGetDatavf(plane_refs.gear, plane_pos.gear, 0, n);
+
+    /* Bounds of our routes */
+    x0 = airport.cell_x;  x1 = x0 + airport.cells_lon * airport.cell_dx;
+    z0 = airport.cell_z;  z1 = z0 + airport.cells_lat * airport.cell_dz;
+    if (x0 > x1) { float t = x0; x0 = x1; x1 = t; }
+    if (z0 > z1) { float t = z0; z0 = z1; z1 = t; }
+
+    for (i=0; i<n; i++)
+    {
+        plane_acf_t *info = plane_info + i;
+        float reach, reachx, reachz;
+
+        if (plane_pos.gear[i] != 1) continue;			/* Not interested in airborne planes */
+        if (!(plane_pos.x[i] || plane_pos.z[i])) continue;	/* No position data ??? */
+
+        /* Furthest that the plane's footprint can extend from its position, looking as far ahead as any route does */
+        reach = 2 * fabsf(info->cgz) + fabsf(info->length - info->cgz) + fabsf(info->semiwidth) + FOOTPRINT_MARGIN;
+        reachx = reach + fabsf(plane_pos.vx[i]) * airport.lookahead;
+        reachz = reach + fabsf(plane_pos.vz[i]) * airport.lookahead;
+        if (plane_pos.x[i] + reachx >= x0 && plane_pos.x[i] - reachx <= x1 &&
+            plane_pos.z[i] + reachz >= z0 && plane_pos.z[i] - reachz <= z1)
+            near_planes[near_count++] = i;
+    }
+}
+
+
+/* Look up the dimensions of planes that we haven't already got, up to count.
+ * ACF files that we haven't seen before, or that have changed, are read in the background - planes use default
+ * dimensions until then.
+ * TCAS target i is X-Plane's plane i, unless a plugin is supplying the TCAS targets. In that case only the user's plane,
+ * which is always target 0, is one of X-Plane's planes and the rest use default dimensions. */
+static void read_plane_info(int count)
+{
+    int i, total;
     XPLMPluginID controller;
 
-    if (plane_count) return plane_count;
+    if (acf_cache_count < 0) acf_cache_count = read_acf_cache(&acf_cache);
 
-    XPLMCountAircraft(&plane_count, &i, &controller);	/* Use total, cos active may increase later */
-    assert (plane_count > 0);
-    if (plane_count > MAX_PLANES) plane_count = MAX_PLANES;
+    XPLMCountAircraft(&total, &i, &controller);		/* Use total, cos active may increase later */
+    tcas_override = plane_refs.override ? XPLMGetDatai(plane_refs.override) : 0;
 
-    for (i=0; i<plane_count; i++)
+    for (i=acf_count; i<count; i++)
     {
         plane_acf_t *info = plane_info + i;
-        int o;
-        FILE *h;
         char path[MAX_ACF_PATH];
-
-        /* If we've already analysed this ACF then re-use existing data */
-        XPLMGetNthAircraftModel(i, info->name, path);
-        for (o=0; o<i; o++)
-            if (!strcmp(info->name, plane_info[o].name))
-            {
-                memcpy(info, plane_info+o, sizeof(plane_acf_t));
-                break;
-            }
-        if (o<i) continue;
+        struct stat st;
 
         /* Default values in case read fails - a 737-800 */
+        info->name[0] = '\0';
         info->length = 40;
         info->cgz = 18;
         info->semiwidth  = 18;
         info->refheight = 3.5;
+        info->acf = -1;
+        if (i >= total || (i && tcas_override)) continue;	/* Not one of X-Plane's planes, e.g. from a traffic plugin, so no ACF */
 
-        if (!(h = fopen(path, "r"))) continue;
-        o = fgetc(h);
-        if (o=='I' || o=='A')
-            read_v10_plane(h, o, info);
-        else if (o=='i' || o=='a')
-            read_old_plane(h, o, info);
-        fclose(h);
+        XPLMGetNthAircraftModel(i, info->name, path);
+        if (stat(path, &st) || (info->acf = find_acf(path, st.st_size, st.st_mtime)) < 0) continue;
+        if (acf_cache[info->acf].parsed)
+        {
+            info->length    = acf_cache[info->acf].length;
+            info->semiwidth = acf_cache[info->acf].semiwidth;
+            info->refheight = acf_cache[info->acf].refheight;
+            info->cgz       = acf_cache[info->acf].cgz;
+        }
+    }
+    acf_count = count;
+    start_acf_worker();
+}
+
+
+/* Index of ACF file in ACF cache, adding it if it's new or resetting it if it's changed. Returns -1 if out of memory */
+static int find_acf(const char *path, long long size, long long mtime)
+{
+    acf_entry_t *entry;
+    int i;
+
+    if (strlen(path) >= MAX_ACF_PATH) return -1;
+    for (i=0; i<acf_cache_count; i++)
+        if (!strcmp(path, acf_cache[i].path))
+            break;
+    if (i == acf_cache_count)
+    {
+        if (!(entry = realloc(acf_cache, (acf_cache_count+1) * sizeof(acf_entry_t))))
+        {
+            xplog("Out of memory!");
+            return -1;
+        }
+        acf_cache = entry;
+        acf_cache_count++;
+    }
+    else if (acf_cache[i].size == size && acf_cache[i].mtime == mtime)
+    {
+        return i;
+    }
+
+    entry = acf_cache + i;
+    memset(entry, 0, sizeof(acf_entry_t));
+    strcpy(entry->path, path);
+    entry->size = size;
+    entry->mtime = mtime;
+    return i;
+}
+
+
+/* Start reading any ACF files that we haven't read, unless we're already reading some */
+static void start_acf_worker()
+{
+    int i, n;
+
+    if (acf_jobs) return;
+    for (i=0, n=0; i<acf_cache_count; i++)
+        if (!acf_cache[i].parsed) n++;
+    if (!n) return;
+
+    if (!(acf_jobs = malloc(n * sizeof(acf_entry_t))))
+    {
+        xplog("Out of memory!");
+        return;
+    }
+    for (i=0, acf_njobs=0; i<acf_cache_count; i++)
+        if (!acf_cache[i].parsed)
+            acf_jobs[acf_njobs++] = acf_cache[i];
+    if (!worker_start(&acf_worker, read_acfs, NULL))
+    {
+        free(acf_jobs);
+        acf_jobs = NULL;
+        acf_njobs = 0;
+    }
+}
+
+
+/* Worker has finished - apply the dimensions that it read to the cache and to the planes that use those ACF files */
+static void finish_acf_worker()
+{
+    int i, j;
+
+    for (j=0; j<acf_njobs; j++)
+        for (i=0; i<acf_cache_count; i++)
+            if (!acf_cache[i].parsed && !strcmp(acf_jobs[j].path, acf_cache[i].path) &&
+                acf_jobs[j].size == acf_cache[i].size && acf_jobs[j].mtime == acf_cache[i].mtime)	/* Unchanged since */
+            {
+                acf_cache[i] = acf_jobs[j];
+                break;
+            }
+    free(acf_jobs);
+    acf_jobs = NULL;
+    acf_njobs = 0;
+
+    for (i=0; i<acf_count; i++)
+    {
+        plane_acf_t *info = plane_info + i;
+        if (info->acf >= 0 && acf_cache[info->acf].parsed)
+        {
+            info->length    = acf_cache[info->acf].length;
+            info->semiwidth = acf_cache[info->acf].semiwidth;
+            info->refheight = acf_cache[info->acf].refheight;
+            info->cgz       = acf_cache[info->acf].cgz;
+        }
+    }
+
+    write_acf_cache(acf_cache, acf_cache_count);
+    start_acf_worker();		/* In case any planes changed while we were reading */
+}
+
+
+/* Worker thread. Reads the ACF files in acf_jobs */
+static void *read_acfs(void *arg)
+{
+    int i;
+
+    for (i=0; i<acf_njobs; i++)
+    {
+        worker_check_stop(&acf_worker);
+        read_acf(acf_jobs + i);
     }
 
-    return plane_count;
+    worker_has_finished(&acf_worker);
+    return NULL;
+}
+
+
+/* Read an ACF file's dimensions. Runs on the worker thread so mustn't call X-Plane.
+ * The file is read in one go rather than in small pieces, since ACF files can be several MB. */
+static void read_acf(acf_entry_t *entry)
+{
+    unsigned char *buf;
+    long size;
+    FILE *h;
+
+    /* Default values in case read fails - a 737-800. Failures are cached too, so we don't keep trying. */
+    entry->length = 40;
+    entry->cgz = 18;
+    entry->semiwidth  = 18;
+    entry->refheight = 3.5;
+    entry->parsed = -1;
+
+    if (!(h = fopen(entry->path, "rb"))) return;
+    if (fseek(h, 0, SEEK_END) || (size = ftell(h)) <= 0 || fseek(h, 0, SEEK_SET) || !(buf = malloc(size+1)))
+    {
+        fclose(h);
+        return;
+    }
+    if (fread(buf, size, 1, h) == 1)
+    {
+        buf[size] = '\0';
+        if (buf[0]=='I' || buf[0]=='A')
+            read_v10_plane((char *) buf, (char *) buf + size, entry);
+        else if (buf[0]=='i' || buf[0]=='a')
+            read_old_plane(buf, size, buf[0], entry);
+    }
+    free(buf);
+    fclose(h);
 }
 
 
-static void read_v10_plane(FILE *h, int platform, plane_acf_t *info)
+static void read_v10_plane(const char *buf, const char *end, acf_entry_t *entry)
 {
-    char line[256], *c1, *c2;
-    int eol1;
-    int version;
-
-    if (!fgets(line, sizeof(line), h)) return;
-    if (!fgets(line, sizeof(line), h)) return;
-    c1=strtok(line, sep);
-    c2=strtok(NULL, sep);
-    if (!c1 || !sscanf(c1, "%d%n", &version, &eol1) || c1[eol1] ||
-        strcmp(c2, "version") ||
+    const char *line, *eol, *c;
+    int version, eol1;
+
+    /* Second line is "<version> version" */
+    if (!(line = memchr(buf, '\n', end - buf))) return;
+    line++;
+    c = line + strspn(line, sep);
+    if (sscanf(c, "%d%n", &version, &eol1) != 1 || !strchr(sep, c[eol1]) ||
+        strncmp((c += eol1 + strspn(c + eol1, sep)), "version", sizeof("version")-1) ||
+        !strchr(sep, c[sizeof("version")-1]) ||
         version < 1004)
         return;	/* doesn't look like an ACF file */
 
-    while (fgets(line, sizeof(line), h))
+    for (; line < end; line = eol + 1)
     {
+        if (!(eol = memchr(line, '\n', end - line))) eol = end;
+
         /* Assume for speed that fields are single-space separated */
-        if (!strncmp(line, "P acf/_size_x ", sizeof("P acf/_size_x ")-1))
+        if (line[0] != 'P')
+            continue;
+        else if (!strncmp(line, "P acf/_size_x ", sizeof("P acf/_size_x ")-1))
         {
-            if (!sscanf(line+sizeof("P acf/_size_x ")-1, "%f", &info->semiwidth)) return;
-            info->semiwidth *= 0.3048f;
+            if (!sscanf(line+sizeof("P acf/_size_x ")-1, "%f", &entry->semiwidth)) return;
+            entry->semiwidth *= 0.3048f;
         }
         else if (!strncmp(line, "P acf/_size_z ", sizeof("P acf/_size_z ")-1))
         {
-            if (!sscanf(line+sizeof("P acf/_size_z ")-1, "%f", &info->length)) return;
-            info->length *= 0.3048f;
+            if (!sscanf(line+sizeof("P acf/_size_z ")-1, "%f", &entry->length)) return;
+            entry->length *= 0.3048f;
         }
         else if (!strncmp(line, "P acf/_h_eqlbm ", sizeof("P acf/_h_eqlbm ")-1))
         {
-            if (!sscanf(line+sizeof("P acf/_h_eqlbm ")-1, "%f", &info->refheight)) return;
-            info->refheight *= 0.3048f;
+            if (!sscanf(line+sizeof("P acf/_h_eqlbm ")-1, "%f", &entry->refheight)) return;
+            entry->refheight *= 0.3048f;
         }
         else if (!strncmp(line, "P acf/_cgZ ", sizeof("P acf/_cgZ ")-1))
         {
-            if (!sscanf(line+sizeof("P acf/_cgZ ")-1, "%f", &info->cgz)) return;
-            info->cgz *= 0.3048f;
+            if (!sscanf(line+sizeof("P acf/_cgZ ")-1, "%f", &entry->cgz)) return;
+            entry->cgz *= 0.3048f;
         }
     }
 }
 
-static size_t freadswap(void *ptr, size_t size, size_t nitems, FILE *stream)
-{
-    unsigned char *c = ptr;
-    int i, b;
 
-    for (i=0; i<nitems; i++, c+=size)
-        for (b=size-1; b>=0; b--)
-            if (!fread(c + b, 1, 1, stream)) return i;
+/* Read a 4 byte value from an old-style binary ACF file, swapping bytes if the file's byte order differs from ours */
+static int getacf4(const unsigned char *buf, long size, long offset, int swap, void *out)
+{
+    unsigned char *c = out;
+    int b;
 
-    return nitems;
+    if (offset + 4 > size) return 0;
+    for (b=0; b<4; b++)
+        c[swap ? 3-b : b] = buf[offset+b];
+    return -1;
 }
 
-static void read_old_plane(FILE *h, int platform, plane_acf_t *info)
+static void read_old_plane(const unsigned char *buf, long size, int platform, acf_entry_t *entry)
 {
     int version = 0;
-    size_t (*readfn)(void *, size_t, size_t, FILE *) = platform=='i' ? fread : freadswap;
+    int swap = platform!='i';
 
     assert(sizeof(int) == 4);	/* Code below assumes this - could use int32_t */
-    readfn(&version, 4, 1, h);
+    if (!getacf4(buf, size, 1, swap, &version)) return;
 
     /* WB_cgZ */
     if (version>=700 && version<=740)
     {
-        if (fseek(h, 0x98a45, SEEK_SET)) return;
+        if (!getacf4(buf, size, 0x98a45, swap, &entry->cgz)) return;
     }
     else if  ((version>=800 && version<=941) || version==8000)
     {
-        if (fseek(h, 0x21489, SEEK_SET)) return;
+        if (!getacf4(buf, size, 0x21489, swap, &entry->cgz)) return;
     }
     else	/* unknown version */
     {
         return;
     }
-    if (!readfn(&info->cgz, 4, 1, h)) return;
-    info->cgz *= 0.3048f;
+    entry->cgz *= 0.3048f;
 
     /* AUTO_size_x, AUTO_size_z */
-    if (version<=740)
-    {
-        if (fseek(h, 0x9bc2d, SEEK_SET)) return;
-    }
-    else
-    {
-        if (fseek(h, 0x21711, SEEK_SET)) return;
-    }
-    if (!readfn(&info->semiwidth, 4, 1, h)) return;
-    info->semiwidth *= 0.3048f;
-    if (!readfn(&info->length, 4, 1, h)) return;
-    info->length *= 0.3048f;
+    if (!getacf4(buf, size, version<=740 ? 0x9bc2d : 0x21711, swap, &entry->semiwidth)) return;
+    entry->semiwidth *= 0.3048f;
+    if (!getacf4(buf, size, version<=740 ? 0x9bc31 : 0x21715, swap, &entry->length)) return;
+    entry->length *= 0.3048f;
 
     /* AUTO_h_eqlbm */
-    if (version<=740)
-    {
-        if (fseek(h, 0x9bc3d, SEEK_SET)) return;
-    }
-    else
-    {
-        if (fseek(h, 0x2171d, SEEK_SET)) return;
-    }
-    if (!readfn(&info->refheight, 4, 1, h)) return;
-    info->refheight *= 0.3048f;
+    if (!getacf4(buf, size, version<=740 ? 0x9bc3d : 0x2171d, swap, &entry->refheight)) return;
+    entry->refheight *= 0.3048f;
 }
 
 
 plane_acf_t *get_plane_info(int planeno)
 {
-    return plane_info + planeno;
+    assert(planeno < near_count);
+    return plane_info + near_planes[planeno];
 }
 
 
 int get_plane_pos(plane_pos_t *pos, int planeno)
 {
-    plane_ref_t *plane_ref = plane_refs + planeno;
-    float gear;
-
-    assert(planeno < plane_count);
-    if (!XPLMGetDatavf(plane_ref->gear, &gear, 0, 1) || gear!=1) return 0;	/* Not interested in airborne planes */
-
-    pos->p.x = XPLMGetDataf(plane_ref->x);
-    pos->p.y = XPLMGetDataf(plane_ref->y);
-    pos->p.z = XPLMGetDataf(plane_ref->z);
-    if (!(pos->p.x || pos->p.z)) return 0;	/* No position data ??? */
+    int i;
 
-    pos->v.x = XPLMGetDataf(plane_ref->vx);
+    assert(planeno < near_count);
+    i = near_planes[planeno];
+    pos->p.x = plane_pos.x[i];
+    pos->p.y = plane_pos.y[i];
+    pos->p.z = plane_pos.z[i];
+    pos->v.x = plane_pos.vx[i];
     pos->v.y = 0;				/* Don't care about vertical speed */
-    pos->v.z = XPLMGetDataf(plane_ref->vz);
-    pos->hdg = XPLMGetDataf(plane_ref->hdg);
+    pos->v.z = plane_pos.vz[i];
+    pos->hdg = plane_pos.hdg[i];
 
     return -1;
 }
 
 
-/* Get a plane's ground footprint.
- * Returns NULL if the plane is airborne. Otherwise returns pointer to a statically allocated
- * array of 4 points, contents of which will be overwritten on next call. */
-point_t *get_plane_footprint(int planeno, float time)
+/* Calculate the parts of a plane's footprint that are common to every route that checks it this frame */
+static void update_plane_footprint(int planeno)
 {
-    static point_t p[4];	/* footprint rectangle */
-    
+    plane_footprint_t *fp = plane_footprints + planeno;
+    plane_acf_t *info = get_plane_info(planeno);
     plane_pos_t pos;
-    plane_acf_t *info = plane_info + planeno;
-    float gndy, h, cosh, sinh;
-    point_t proj, tail, semi;
+    float h, cosh, sinh;
 
-    if (!get_plane_pos(&pos, planeno)) return NULL;
+    fp->frame = last_frame;
+    get_plane_pos(&pos, planeno);
 
-    gndy = pos.p.y - info->refheight;
+    fp->gndy = pos.p.y - info->refheight;
     h = D2R(pos.hdg);
     cosh = cosf(h);
     sinh = sinf(h);
-    if (pos.v.x || pos.v.z)
+    if ((fp->moving = (pos.v.x || pos.v.z)))
     {
         /* Add space in front of plane */
-        proj.x = pos.p.x + sinh * 2 * info->cgz + time * pos.v.x;
-        proj.z = pos.p.z - cosh * 2 * info->cgz + time * pos.v.z;
+        fp->proj.x = pos.p.x + sinh * 2 * info->cgz;
+        fp->proj.z = pos.p.z - cosh * 2 * info->cgz;
     }
     else
     {
         /* unless plane is *completely* static (i.e. brake on) */
-        proj.x = pos.p.x + sinh * info->cgz;
-        proj.z = pos.p.z - cosh * info->cgz;
+        fp->proj.x = pos.p.x + sinh * info->cgz;
+        fp->proj.z = pos.p.z - cosh * info->cgz;
     }
-    tail.x = pos.p.x - sinh * (info->length - info->cgz);
-    tail.z = pos.p.z + cosh * (info->length - info->cgz);
-    semi.x = cosh * info->semiwidth;
-    semi.z = sinh * info->semiwidth;
-
-    p[0].x = proj.x - semi.x;  p[0].y = gndy;  p[0].z = proj.z - semi.z;
-    p[1].x = proj.x + semi.x;  p[1].y = gndy;  p[1].z = proj.z + semi.z;
-    p[2].x = tail.x + semi.x;  p[2].y = gndy;  p[2].z = tail.z + semi.z;
-    p[3].x = tail.x - semi.x;  p[3].y = gndy;  p[3].z = tail.z - semi.z;
+    fp->tail.x = pos.p.x - sinh * (info->length - info->cgz);
+    fp->tail.z = pos.p.z + cosh * (info->length - info->cgz);
+    fp->semi.x = cosh * info->semiwidth;
+    fp->semi.z = sinh * info->semiwidth;
+    fp->v = pos.v;
+}
+
+
+/* Get a plane's ground footprint, looking time seconds ahead.
+ * Returns NULL if its footprint lies clear of the bounds of the path segment p0->p1 (pass NULL to skip this test). Otherwise returns pointer to a statically allocated array of 4 points, contents of
+ * which will be overwritten on next call. */
+point_t *get_plane_footprint(int planeno, float time, const point_t *p0, const point_t *p1)
+{
+    static point_t p[4];	/* footprint rectangle */
+
+    plane_footprint_t *fp = plane_footprints + planeno;
+    point_t proj;
+
+    assert(planeno < near_count);
+    if (fp->frame != last_frame) update_plane_footprint(planeno);
+
+    if (fp->moving)
+    {
+        proj.x = fp->proj.x + time * fp->v.x;
+        proj.z = fp->proj.z + time * fp->v.z;
+    }
+    else
+        proj = fp->proj;
+
+    if (p0)
+    {
+        float semix = fabsf(fp->semi.x) + FOOTPRINT_MARGIN, semiz = fabsf(fp->semi.z) + FOOTPRINT_MARGIN;
+        if (fminf(proj.x, fp->tail.x) - semix > fmaxf(p0->x, p1->x) ||
+            fmaxf(proj.x, fp->tail.x) + semix < fminf(p0->x, p1->x) ||
+            fminf(proj.z, fp->tail.z) - semiz > fmaxf(p0->z, p1->z) ||
+            fmaxf(proj.z, fp->tail.z) + semiz < fminf(p0->z, p1->z))
+            return NULL;	/* Can't be in the way */
+    }
+
+    p[0].x = proj.x - fp->semi.x;  p[0].y = fp->gndy;  p[0].z = proj.z - fp->semi.z;
+    p[1].x = proj.x + fp->semi.x;  p[1].y = fp->gndy;  p[1].z = proj.z + fp->semi.z;
+    p[2].x = fp->tail.x + fp->semi.x;  p[2].y = fp->gndy;  p[2].z = fp->tail.z + fp->semi.z;
+    p[3].x = fp->tail.x - fp->semi.x;  p[3].y = fp->gndy;  p[3].z = fp->tail.z - fp->semi.z;
 
     return p;
 }
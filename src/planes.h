@@ -14,32 +14,66 @@ typedef __int32 int32_t;
 
 #include "groundtraffic.h"
 
-#define MAX_PLANES 20		/* Seems to be a hard-coded limit in X-Plane, but maybe could increase in future */
 #define MAX_ACF_NAME 256
 #define MAX_ACF_PATH 512
+#define FOOTPRINT_MARGIN 1.f	/* Slop [m] when culling footprints by bounds, to allow for rounding */
+#define ACF_CACHE "groundtraffic_acf.cache"
+#define ACF_CACHE_MAGIC "GTac"
+#define ACF_CACHE_VERSION 1
 
 typedef struct
 {
-    XPLMDataRef x, y, z, vx, vz, hdg, gear; 
+    XPLMDataRef count, x, y, z, vx, vz, hdg, gear;
+    XPLMDataRef override;	/* Whether a plugin is supplying TCAS targets. NULL before X-Plane 11.50 */
 } plane_ref_t;
 
+/* Positions of all planes, read in bulk once per frame */
+typedef struct
+{
+    float *x, *y, *z, *vx, *vz, *hdg, *gear;
+} plane_bulk_t;
+
 typedef struct
 {
     point_t p, v;		/* Position [m], speed [m/s] */
     float hdg;			/* [degrees] */
 } plane_pos_t;
 
+/* Parts of a plane's ground footprint that don't depend on how far ahead we're looking. Calculated once per frame */
+typedef struct
+{
+    float frame;		/* Value of last_frame when calculated */
+    int moving;
+    point_t proj, tail;		/* Centre of front and back edges, assuming no time ahead [m] */
+    point_t semi;		/* Half the width of the footprint [m] */
+    point_t v;			/* Speed [m/s] */
+    float gndy;
+} plane_footprint_t;
+
 typedef struct
 {
     char name[MAX_ACF_NAME];
     float length, semiwidth, refheight, cgz;	/* dimensions [m] */
+    int acf;			/* Index of ACF file in ACF cache, or -1 */
 } plane_acf_t;
 
+/* ACF file whose dimensions we've read, or are reading in the background. Saved to the ACF cache */
+typedef struct
+{
+    char path[MAX_ACF_PATH];
+    long long size, mtime;	/* Of the ACF file when we read it, to detect changes */
+    float length, semiwidth, refheight, cgz;	/* dimensions [m] */
+    int parsed;			/* Whether we've finished reading it */
+} acf_entry_t;
+
 
 /* prototypes */
 int setup_plane_refs();
 void reset_planes();
+void stop_planes();
+int read_acf_cache(acf_entry_t **entries);
+void write_acf_cache(const acf_entry_t *entries, int count);
 int count_planes();
 plane_acf_t *get_plane_info(int planeno);
 int get_plane_pos(plane_pos_t *pos, int planeno);
-point_t *get_plane_footprint(int planeno, float time);
+point_t *get_plane_footprint(int planeno, float time, const point_t *p0, const point_t *p1);
@@ -18,6 +18,7 @@ static const char sep[]=" \t\r\n";
 /* In this file */
 static setcmd_t *readsetcmd(airport_t *airport, route_t *currentroute, path_t *node, char *buffer, int lineno);
 static route_t *expandtrain(airport_t *airport, route_t *currentroute);
+static void assigncells(airport_t *airport);
 
 const glColor3f_t colors[16] = { { 0.0, 1.0, 0.0 }, // lime (match DRE color)
                                  { 1.0, 0.0, 0.0 }, // red
@@ -45,15 +46,25 @@ void clearconfig(airport_t *airport)
     extref_t *extref;
 
     deactivate(airport);
+    deactivate2(airport, 0);	/* Synchronously */
 
     airport->tower.lat=airport->tower.lon=0;
     airport->tower.alt = (double) INVALID_ALT;
     airport->state = noconfig;
     airport->done_first_activation = 0;
+    airport->done_collisions = 0;
     airport->new_airport = -1;	/* Reloaded config causes synchronous load */
     airport->drawroutes = 0;
     airport->reflections = 0;
+    airport->maxthreads = 0;
     airport->active_distance = ACTIVE_DISTANCE;
+    airport->cells_lat = airport->cells_lon = 0;
+    airport->live_cells = 0;
+    free(airport->collisions);
+    airport->collisions = NULL;
+    free(airport->zones);
+    airport->zones = NULL;
+    airport->deadlocks = 0;
 
     route = airport->routes;
     while (route)
@@ -65,16 +76,9 @@ void clearconfig(airport_t *airport)
             int i;
             for (i=0; i<route->pathlen; i++)
             {
-                collision_t *collision = route->path[i].collisions;
                 setcmd_t    *setcmd    = route->path[i].setcmds;
                 whenref_t   *whenref   = route->path[i].whenrefs;
 
-                while (collision)
-                {
-                    collision_t *next = collision->next;
-                    free (collision);
-                    collision = next;
-                }
                 while (setcmd)
                 {
                     setcmd_t *next = setcmd->next;
@@ -91,15 +95,22 @@ void clearconfig(airport_t *airport)
             free(route->path);
             free(route->varrefs);
             if (route->highway)
+            {
                 for (i=0; i<MAX_HIGHWAY; free(route->highway->objects[i++].name));
+                free(route->highway->holders);
+                free(route->highway->drawn);
+            }
             free(route->highway);
         }
+        free(route->trail);
         free(route->object.name);
         free(route->object.physical_name);
-        free(route);
+        if (!airport->routetbl) free(route);
         route = nextroute;
     }
-    airport->routes = airport->firstroute = NULL;
+    free(airport->routetbl);
+    airport->routes = airport->firstroute = airport->routetbl = NULL;
+    airport->nroutes = airport->nleaders = 0;
 
     train = airport->trains;
     while (train)
@@ -137,6 +148,20 @@ void clearconfig(airport_t *airport)
 
     free(airport->drawinfo);
     airport->drawinfo = NULL;
+    free(airport->cars);
+    airport->cars = NULL;
+    free(airport->cardrawinfo);
+    airport->cardrawinfo = NULL;
+    airport->ncars = airport->maxcars = 0;
+    free(airport->loadqueue);
+    airport->loadqueue = NULL;
+    free(airport->turns);
+    airport->turns = NULL;
+    free(airport->beziers);
+    airport->beziers = NULL;
+    free(airport->legs);
+    airport->legs = NULL;
+    airport->loadcount = airport->loadnext = 0;
 
     free(labeltbl);
     labeltbl = NULL;
@@ -682,6 +707,15 @@ int readconfig(char *pkgpath, airport_t *airport)
             airport->drawroutes = -1;
             if ((c1=strtok(NULL, sep))) return failconfig(h, airport, buffer, "Extraneous input \"%s\" at line %d", c1, lineno);
         }
+        else if (!strcasecmp(c1, "threads"))
+        {
+            c1=strtok(NULL, sep);
+            if (!c1 || !sscanf(c1, "%d%n", &airport->maxthreads, &eol1) || c1[eol1])
+                return failconfig(h, airport, buffer, "Expecting a number of threads, found \"%s\" at line %d", N(c1), lineno);
+            else if (airport->maxthreads < 1)
+                return failconfig(h, airport, buffer, "Number of threads must be at least 1 at line %d", lineno);
+            if ((c1=strtok(NULL, sep))) return failconfig(h, airport, buffer, "Extraneous input \"%s\" at line %d", c1, lineno);
+        }
         else if (!doneprologue)	/* Used to be airport header ICAO lat lon */
         {
             /* Silently skip input if in valid old format */
@@ -700,6 +734,10 @@ int readconfig(char *pkgpath, airport_t *airport)
         doneprologue = -1;
     }
 
+    /* Divide routes into cells. Do this before expanding trains so that carriages inherit their parent's cells */
+    airport->bbox = bounds;
+    assigncells(airport);
+
     /* Turn train routes into multiple individual routes */
     currentroute = airport->routes;
     while (currentroute)
@@ -727,11 +765,12 @@ int readconfig(char *pkgpath, airport_t *airport)
 
     /* Finishing up */
 #ifdef DEBUG
-    sprintf(buffer, "Tower=%.9lf,%.9lf r=%d", airport->tower.lat, airport->tower.lon, (int) airport->active_distance);
+    sprintf(buffer, "Tower=%.9lf,%.9lf r=%d cells=%dx%d", airport->tower.lat, airport->tower.lon, (int) airport->active_distance, airport->cells_lat, airport->cells_lon);
     xplog(buffer);
 #endif
     airport->state = inactive;
-    airport->active_distance += (water ? ACTIVE_WATER : ACTIVE_DISTANCE);
+    airport->cell_distance = water ? ACTIVE_WATER : ACTIVE_DISTANCE;
+    airport->active_distance += airport->cell_distance;
 
     if (airport->drawroutes)
     {
@@ -900,7 +939,56 @@ static route_t *expandtrain(airport_t *airport, route_t *currentroute)
         route->object.offset = train->objects[i].offset;
         route->object.heading = train->objects[i].heading;
         route->next_time = -route->object.lag;				/* Force recalc on first draw */
+        if (train->objects[i].lag > currentroute->trainlength)
+            currentroute->trainlength = train->objects[i].lag;		/* Head keeps conflict zones until the tail clears them */
     }
 
+    /* Enough of the head's trail to reach back to the last car. Points are at least TRAIL_STEP apart, plus the newest */
+    currentroute->trailsize = (int) ((currentroute->trainlength - train->objects[0].lag) / TRAIL_STEP) + 3;
+    if (!(currentroute->trail = malloc(currentroute->trailsize * sizeof(trail_t)))) return NULL;	/* OOM */
+
     return route;
 }
+
+
+/* Divide the airport's bounding box into a grid of cells and note which cells each route passes through.
+ * Each path segment is assigned to every cell that its bounding box overlaps, so a route can belong to many cells. */
+static void assigncells(airport_t *airport)
+{
+    bbox_t *bounds = &airport->bbox;
+    route_t *route;
+    float height = (bounds->maxlat - bounds->minlat) * (float) (M_PI/180) * RADIUS;
+    float width  = (bounds->maxlon - bounds->minlon) * (float) (M_PI/180) * RADIUS * cosf((bounds->minlat + bounds->maxlat) * (float) (M_PI/360));
+
+    airport->cells_lat = (int) ceilf(height / CELL_SIZE);
+    airport->cells_lon = (int) ceilf(width  / CELL_SIZE);
+    if (airport->cells_lat < 1) airport->cells_lat = 1; else if (airport->cells_lat > MAX_CELLS) airport->cells_lat = MAX_CELLS;
+    if (airport->cells_lon < 1) airport->cells_lon = 1; else if (airport->cells_lon > MAX_CELLS) airport->cells_lon = MAX_CELLS;
+
+    for (route = airport->routes; route; route = route->next)
+    {
+        int i;
+
+        route->cells = 0;
+        for (i=0; i<route->pathlen; i++)
+        {
+            loc_t *p0 = &route->path[i].waypoint, *p1;
+            int lat0, lat1, lon0, lon1, lat, lon;
+
+            if (i+1 < route->pathlen)
+                p1 = &route->path[i+1].waypoint;
+            else if (route->highway || route->path[i].flags.reverse)
+                p1 = p0;	/* Reversible and highway routes don't circle back */
+            else
+                p1 = &route->path[0].waypoint;
+
+            lat0 = celllat(airport, p0->lat < p1->lat ? p0->lat : p1->lat);
+            lat1 = celllat(airport, p0->lat < p1->lat ? p1->lat : p0->lat);
+            lon0 = celllon(airport, p0->lon < p1->lon ? p0->lon : p1->lon);
+            lon1 = celllon(airport, p0->lon < p1->lon ? p1->lon : p0->lon);
+            for (lat = lat0; lat <= lat1; lat++)
+                for (lon = lon0; lon <= lon1; lon++)
+                    route->cells |= ((cellmask_t) 1) << (lat * airport->cells_lon + lon);
+        }
+    }
+}